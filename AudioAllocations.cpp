@@ -0,0 +1,75 @@
+#include "AudioAllocations.hpp"
+
+#ifdef SPOTIFY_BACKSTAGE_COUNT_AUDIO_ALLOCATIONS
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#endif
+
+namespace spotify_backstage {
+
+namespace {
+#ifdef SPOTIFY_BACKSTAGE_COUNT_AUDIO_ALLOCATIONS
+thread_local bool counting = false;
+std::atomic<long long> num_allocations(0);
+#endif
+}
+
+#ifdef SPOTIFY_BACKSTAGE_COUNT_AUDIO_ALLOCATIONS
+
+AudioAllocations::Scope::Scope()
+  : was_counting_(counting)
+{
+    counting = true;
+}
+
+AudioAllocations::Scope::~Scope()
+{
+    counting = was_counting_;
+}
+
+long long AudioAllocations::getCount()
+{
+    return num_allocations;
+}
+
+#else
+
+AudioAllocations::Scope::Scope()
+  : was_counting_(false)
+{
+}
+
+AudioAllocations::Scope::~Scope()
+{
+}
+
+long long AudioAllocations::getCount()
+{
+    return -1;
+}
+
+#endif
+
+}
+
+#ifdef SPOTIFY_BACKSTAGE_COUNT_AUDIO_ALLOCATIONS
+
+// operator new[] and the nothrow versions end up here too
+void* operator new(std::size_t size)
+{
+    if (spotify_backstage::counting)
+        ++spotify_backstage::num_allocations;
+
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+#endif
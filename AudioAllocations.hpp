@@ -0,0 +1,33 @@
+#ifndef SPOTIFY_BACKSTAGE_AUDIOALLOCATIONS_HPP
+#define SPOTIFY_BACKSTAGE_AUDIOALLOCATIONS_HPP
+
+namespace spotify_backstage {
+
+// Counts the heap allocations made on the audio path, that is, by the threads inside a Scope.
+// Counting replaces the global operator new, so it's only built in with SPOTIFY_BACKSTAGE_COUNT_AUDIO_ALLOCATIONS
+// (CMake option COUNT_AUDIO_ALLOCATIONS), for debug builds. Without it, the scopes do nothing.
+class AudioAllocations
+{
+public:
+    // The allocations of the calling thread are counted while a Scope is alive
+    class Scope
+    {
+    public:
+        Scope();
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        // Whether the thread was already counting when the scope started
+        const bool was_counting_;
+    };
+
+    // Allocations counted since the start, -1 if counting isn't built in
+    static long long getCount();
+};
+
+}
+
+#endif
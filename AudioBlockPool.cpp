@@ -0,0 +1,196 @@
+#include "AudioBlockPool.hpp"
+
+#include <algorithm>
+#include <boost/lockfree/stack.hpp>
+#include <utility>
+#include <vector>
+
+namespace spotify_backstage {
+
+namespace {
+// Alignment of the pooled blocks, in samples (64 bytes)
+const int ALIGNMENT = 32;
+
+// Blocks allocated from the heap because a pool was empty or the block didn't fit
+std::atomic<long long> num_misses(0);
+}
+
+class AudioBlockPool::Impl
+{
+public:
+    Impl(AudioBlockPool& pool, int num_blocks, int block_size)
+      : pool_(pool),
+        block_size_(block_size),
+        num_samples_(num_blocks * stride() + ALIGNMENT),
+        samples_(new int16_t[num_samples_]),
+        blocks_(),
+        free_(num_blocks)
+    {
+        // Start of the first block rounded up to the alignment
+        const auto offset = reinterpret_cast<uintptr_t>(samples_.get()) % (ALIGNMENT * sizeof(int16_t));
+        auto* data = samples_.get() + (offset == 0 ? 0 : ALIGNMENT - offset / sizeof(int16_t));
+
+        blocks_.reserve(num_blocks);
+        for (int i = 0; i < num_blocks; ++i)
+        {
+            blocks_.emplace_back(new AudioBlock(data + i * stride(), block_size_, true, pool_));
+            free_.bounded_push(blocks_.back().get());
+        }
+    }
+
+    int getBlockSize() const
+    {
+        return block_size_;
+    }
+
+    const void* getMemory() const
+    {
+        return samples_.get();
+    }
+
+    std::size_t getMemorySize() const
+    {
+        return num_samples_ * sizeof(int16_t);
+    }
+
+    AudioBlockRef acquire(int num_samples)
+    {
+        AudioBlock* block = nullptr;
+        if (num_samples > block_size_ || !free_.pop(block))
+        {
+            const auto capacity = std::max(num_samples, block_size_);
+            block = new AudioBlock(new int16_t[capacity], capacity, false, pool_);
+            ++num_misses;
+        }
+
+        block->sample_rate = 0;
+        block->num_channels = 0;
+        block->size = 0;
+        return AudioBlockRef(block);
+    }
+
+    void release(AudioBlock* block)
+    {
+        if (block->pooled)
+            free_.bounded_push(block);
+        else
+        {
+            delete[] block->data;
+            delete block;
+        }
+    }
+
+private:
+    // Distance between the pooled blocks, in samples
+    int stride() const
+    {
+        return (block_size_ + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    AudioBlockPool& pool_;
+    int block_size_;
+    // Samples of all the pooled blocks, with room for the alignment
+    std::size_t num_samples_;
+    std::unique_ptr<int16_t[]> samples_;
+    std::vector<std::unique_ptr<AudioBlock>> blocks_;
+    boost::lockfree::stack<AudioBlock*> free_;
+};
+
+AudioBlockRef::AudioBlockRef()
+  : block_(nullptr)
+{
+}
+
+AudioBlockRef::AudioBlockRef(AudioBlock* block)
+  : block_(block)
+{
+    ++block_->refs;
+}
+
+AudioBlockRef::AudioBlockRef(const AudioBlockRef& other)
+  : block_(other.block_)
+{
+    if (block_)
+        ++block_->refs;
+}
+
+AudioBlockRef::AudioBlockRef(AudioBlockRef&& other)
+  : block_(other.block_)
+{
+    other.block_ = nullptr;
+}
+
+AudioBlockRef& AudioBlockRef::operator=(AudioBlockRef other)
+{
+    std::swap(block_, other.block_);
+    return *this;
+}
+
+AudioBlockRef::~AudioBlockRef()
+{
+    reset();
+}
+
+AudioBlockRef::operator bool() const
+{
+    return block_ != nullptr;
+}
+
+AudioBlock& AudioBlockRef::operator*() const
+{
+    return *block_;
+}
+
+AudioBlock* AudioBlockRef::operator->() const
+{
+    return block_;
+}
+
+void AudioBlockRef::reset()
+{
+    if (block_ && --block_->refs == 0)
+        block_->pool.release(block_);
+
+    block_ = nullptr;
+}
+
+AudioBlockPool::AudioBlockPool(int num_blocks, int block_size)
+  : impl_(new Impl(*this, num_blocks, block_size))
+{
+}
+
+AudioBlockPool::~AudioBlockPool()
+{
+}
+
+int AudioBlockPool::getBlockSize() const
+{
+    return impl_->getBlockSize();
+}
+
+const void* AudioBlockPool::getMemory() const
+{
+    return impl_->getMemory();
+}
+
+std::size_t AudioBlockPool::getMemorySize() const
+{
+    return impl_->getMemorySize();
+}
+
+AudioBlockRef AudioBlockPool::acquire(int num_samples)
+{
+    return impl_->acquire(num_samples);
+}
+
+long long AudioBlockPool::getNumMisses()
+{
+    return num_misses;
+}
+
+void AudioBlockPool::release(AudioBlock* block)
+{
+    impl_->release(block);
+}
+
+}
@@ -0,0 +1,92 @@
+#ifndef SPOTIFY_BACKSTAGE_AUDIOBLOCKPOOL_HPP
+#define SPOTIFY_BACKSTAGE_AUDIOBLOCKPOOL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace spotify_backstage {
+
+class AudioBlockPool;
+
+// Block of audio samples taken from AudioBlockPool
+struct AudioBlock
+{
+    AudioBlock(int16_t* data_p, int capacity_p, bool pooled_p, AudioBlockPool& pool_p)
+      : sample_rate(0), num_channels(0), size(0), data(data_p), capacity(capacity_p), pooled(pooled_p),
+        refs(0), pool(pool_p)
+    {
+    }
+
+    int sample_rate;
+    int num_channels;
+    // Number of samples in data
+    int size;
+    int16_t* const data;
+    const int capacity;
+    // False for the blocks allocated because the pool was empty or the block didn't fit
+    const bool pooled;
+    // Managed by AudioBlockRef
+    std::atomic<int> refs;
+    AudioBlockPool& pool;
+};
+
+// Reference counted handle to AudioBlock. The block goes back to the pool when the last handle to it is gone.
+// The handles can be copied and released in any thread.
+class AudioBlockRef
+{
+public:
+    AudioBlockRef();
+    AudioBlockRef(const AudioBlockRef& other);
+    AudioBlockRef(AudioBlockRef&& other);
+    AudioBlockRef& operator=(AudioBlockRef other);
+    ~AudioBlockRef();
+
+    explicit operator bool() const;
+    AudioBlock& operator*() const;
+    AudioBlock* operator->() const;
+
+    void reset();
+
+private:
+    friend class AudioBlockPool;
+    explicit AudioBlockRef(AudioBlock* block);
+
+    AudioBlock* block_;
+};
+
+// Fixed number of audio blocks, allocated at construction and recycled through a lock-free free list.
+// The pooled blocks are aligned to cache lines. The pool must outlive the blocks taken from it.
+class AudioBlockPool
+{
+public:
+    // num_blocks blocks of block_size samples
+    AudioBlockPool(int num_blocks, int block_size);
+    ~AudioBlockPool();
+
+    int getBlockSize() const;
+
+    // Memory of the pooled blocks, allocated at construction
+    const void* getMemory() const;
+    std::size_t getMemorySize() const;
+
+    // Get a block for num_samples samples. Can be called from any thread. If the pool is empty,
+    // or num_samples doesn't fit in a block, a block is allocated from the heap.
+    AudioBlockRef acquire(int num_samples);
+
+    // Number of blocks all the pools have allocated from the heap in acquire(), because the pool was empty or
+    // the block didn't fit. The blocks preallocated at construction aren't counted.
+    static long long getNumMisses();
+
+private:
+    friend class AudioBlockRef;
+    void release(AudioBlock* block);
+
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+}
+
+#endif
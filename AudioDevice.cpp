@@ -1,9 +1,13 @@
 #include "AudioDevice.hpp"
 
 #include "Logger.hpp"
+#include "AudioAllocations.hpp"
+#include "OutputEqualizer.hpp"
+#include <atomic>
 #include <boost/lockfree/spsc_queue.hpp>
 #include <portaudio.h>
 #include <cstdlib>
+#include <string>
 #include <thread>
 
 #define CHECK_PA_ERR(expr)\
@@ -20,23 +24,38 @@ namespace spotify_backstage {
 
 namespace {
 const int BUFFER_SIZE = 65536;
+// Amount of audio needed to start the stream
+const int PREBUFFER_SIZE = BUFFER_SIZE / 2;
+const int QUICK_PREBUFFER_SIZE = BUFFER_SIZE / 8;
 }
 
 class AudioDevice::Impl
 {
 public:
     Impl()
-      : stream_(nullptr), buffer_(BUFFER_SIZE), sample_rate_(44100), num_channels_(2), output_dev_(0)
+      : stream_(nullptr), buffer_(), sample_rate_(44100), num_channels_(2), output_dev_(-1), output_eq_(nullptr),
+        num_underruns_(0), logged_underruns_(0), write_position_(0), read_position_(0), devices_(), paused_(false), quick_start_(false)
     {
-        CHECK_PA_ERR(Pa_Initialize());
-        CHECK_PA_ERR(Pa_OpenDefaultStream(&stream_, 0, num_channels_, paInt16, sample_rate_, paFramesPerBufferUnspecified, staticCallback, this));
-        output_dev_ = Pa_GetDefaultOutputDevice();
     }
 
     ~Impl()
     {
-        CHECK_PA_ERR(Pa_CloseStream(stream_));
-        CHECK_PA_ERR(Pa_Terminate());
+        if (stream_)
+        {
+            CHECK_PA_ERR(Pa_CloseStream(stream_));
+            CHECK_PA_ERR(Pa_Terminate());
+        }
+    }
+
+    void open()
+    {
+        if (stream_)
+            return;
+
+        CHECK_PA_ERR(Pa_Initialize());
+        CHECK_PA_ERR(Pa_OpenDefaultStream(&stream_, 0, num_channels_, paInt16, sample_rate_, paFramesPerBufferUnspecified, staticCallback, this));
+        output_dev_ = Pa_GetDefaultOutputDevice();
+        enumerateDevices();
     }
 
     int getCurrentOutputDevice() const
@@ -46,13 +65,7 @@ public:
 
     std::vector<std::pair<int, std::string>> getOutputDevices() const
     {
-        std::vector<std::pair<int, std::string>> devices;
-
-        for (int i = 0; i < Pa_GetDeviceCount(); ++i)
-            if (Pa_GetDeviceInfo(i)->maxOutputChannels > 0)
-                devices.push_back(std::make_pair(i, Pa_GetDeviceInfo(i)->name));
-
-        return devices;
+        return devices_;
     }
 
     int getWriteAvailable() const
@@ -60,15 +73,96 @@ public:
         return buffer_.write_available();
     }
 
-    void flush()
+    long long getNumUnderruns() const
+    {
+        return num_underruns_;
+    }
+
+    const void* getBufferMemory() const
+    {
+        return &buffer_;
+    }
+
+    std::size_t getBufferMemorySize() const
+    {
+        return sizeof(buffer_);
+    }
+
+    long long getWritePosition() const
+    {
+        return write_position_;
+    }
+
+    long long getReadPosition() const
+    {
+        return read_position_;
+    }
+
+    void flush(bool quick_start = false)
     {
         LOG("Flushing");
-        stopStream();
+        if (stream_)
+            stopStream();
         buffer_.reset();
+        // The stream is stopped, so the callback doesn't touch the read position now
+        read_position_ = write_position_.load();
+        quick_start_ = quick_start;
+    }
+
+    void pause()
+    {
+        LOG("Pausing");
+        paused_ = true;
+
+        // Unlike the flushes, the audio already passed to the device is played out, so none of it is lost
+        if (stream_ && Pa_IsStreamActive(stream_))
+        {
+            CHECK_PA_ERR(Pa_StopStream(stream_));
+        }
+    }
+
+    void resume()
+    {
+        LOG("Resuming");
+        paused_ = false;
+
+        // The audio buffered before the pause is played right away
+        if (stream_ && Pa_IsStreamStopped(stream_) && buffer_.read_available() > 0)
+        {
+            CHECK_PA_ERR(Pa_StartStream(stream_));
+        }
+    }
+
+    void refreshOutputDevices()
+    {
+        if (!stream_)
+        {
+            open();
+            return;
+        }
+
+        // PortAudio only enumerates the devices when initialized
+        const auto* info = Pa_GetDeviceInfo(output_dev_);
+        const std::string dev_name = info ? info->name : "";
+        flush();
+        CHECK_PA_ERR(Pa_CloseStream(stream_));
+        stream_ = nullptr;
+        CHECK_PA_ERR(Pa_Terminate());
+        CHECK_PA_ERR(Pa_Initialize());
+        enumerateDevices();
+
+        // The indices may have changed
+        auto dev = Pa_GetDefaultOutputDevice();
+        for (const auto& device : devices_)
+            if (device.second == dev_name)
+                dev = device.first;
+
+        reopenStream(sample_rate_, num_channels_, dev);
     }
 
     void setOutputDevice(int dev)
     {
+        open();
         LOG("Setting output device to " << dev);
 
         if (dev < 0 || dev >= Pa_GetDeviceCount())
@@ -83,34 +177,63 @@ public:
         reopenStream(sample_rate_, num_channels_, dev);
     }
 
-    int write(int sample_rate, int num_channels, const std::vector<int16_t>& audio_data)
+    void setOutputEqualizer(OutputEqualizer* eq)
     {
+        if (eq)
+            eq->setFormat(num_channels_, sample_rate_);
+        output_eq_ = eq;
+    }
+
+    int write(int sample_rate, int num_channels, const int16_t* audio_data, int num_samples)
+    {
+        open();
+
         if (sample_rate != sample_rate_ || num_channels != num_channels_)
         {
             LOG("Change in sample rate / number of channels");
-            flush();
+            flush(quick_start_);
             reopenStream(sample_rate, num_channels, output_dev_);
         }
 
-        if (static_cast<int>(audio_data.size()) > getWriteAvailable())
+        if (num_samples > getWriteAvailable())
         {
-            LOG("Trying to write more than buffer can hold: " << audio_data.size());
+            LOG("Trying to write more than buffer can hold: " << num_samples);
             return 0;
         }
 
-        const auto retval = buffer_.push(audio_data.data(), audio_data.size());
+        const long long num_underruns = num_underruns_;
+        if (num_underruns != logged_underruns_)
+        {
+            LOG("GLITCH: " << num_underruns - logged_underruns_ << " underruns");
+            logged_underruns_ = num_underruns;
+        }
+
+        const auto retval = buffer_.push(audio_data, num_samples);
+        write_position_ += retval;
         startStream();
 
         return retval;
     }
 
 private:
+    void enumerateDevices()
+    {
+        devices_.clear();
+
+        for (int i = 0; i < Pa_GetDeviceCount(); ++i)
+            if (Pa_GetDeviceInfo(i)->maxOutputChannels > 0)
+                devices_.push_back(std::make_pair(i, Pa_GetDeviceInfo(i)->name));
+
+        LOG("Found " << devices_.size() << " output devices");
+    }
+
     // Start stream if it's not already started
     void startStream()
     {
-        if (Pa_IsStreamStopped(stream_) && streamCanBeStarted())
+        if (!paused_ && Pa_IsStreamStopped(stream_) && streamCanBeStarted())
         {
             CHECK_PA_ERR(Pa_StartStream(stream_));
+            quick_start_ = false;
         }
     }
 
@@ -134,7 +257,16 @@ private:
         params.suggestedLatency = 0.0;
         params.hostApiSpecificStreamInfo = nullptr;
 
-        CHECK_PA_ERR(Pa_CloseStream(stream_));
+        if (stream_)
+        {
+            CHECK_PA_ERR(Pa_CloseStream(stream_));
+        }
+
+        // Set up the output equalizer while the callback isn't running
+        auto* eq = output_eq_.load();
+        if (eq)
+            eq->setFormat(num_channels, sample_rate);
+
         CHECK_PA_ERR(Pa_OpenStream(&stream_, nullptr, &params, sample_rate, paFramesPerBufferUnspecified, paNoFlag, staticCallback, this));
 
         sample_rate_ = sample_rate;
@@ -145,21 +277,30 @@ private:
     bool streamCanBeStarted() const
     {
         // allow starting the stream when we have enough data
-        return buffer_.read_available() >= BUFFER_SIZE / 2;
+        return buffer_.read_available() >= static_cast<size_t>(quick_start_ ? QUICK_PREBUFFER_SIZE : PREBUFFER_SIZE);
     }
 
     int audioCallback(int16_t* outbuf, unsigned long num_frames_requested)
     {
+        AudioAllocations::Scope counted;
+
         // This is the callback function run in the audio driver thread. It should run fast. No
         // - Locking
-        // - Heavy filter calculations
+        // - Allocating or logging
+        // - Filter setup: the output equalizer's filters are built in the thread setting them
 
         const auto num_samples = num_channels_ * num_frames_requested;
+        const long long position = read_position_;
         const auto avail = buffer_.pop(outbuf, num_samples);
+        // Logged in the writing thread
         if (avail != num_samples)
-        {
-            LOG("GLITCH: asked " << num_samples << ", got " << avail);
-        }
+            ++num_underruns_;
+
+        // The output equalizer is light enough to be run here, and this way its changes are heard right away
+        auto* eq = output_eq_.load();
+        if (eq)
+            eq->process(outbuf, avail, num_channels_, sample_rate_, position);
+        read_position_ = position + avail;
 
         return paContinue;
     }
@@ -176,10 +317,21 @@ private:
     }
 
     PaStream* stream_;
-    boost::lockfree::spsc_queue<int16_t> buffer_;
+    // Sized at compile time, so the samples are stored in the object itself, and can be locked in memory with it
+    boost::lockfree::spsc_queue<int16_t, boost::lockfree::capacity<BUFFER_SIZE>> buffer_;
     int sample_rate_;
     int num_channels_;
     int output_dev_;
+    std::atomic<OutputEqualizer*> output_eq_;
+    std::atomic<long long> num_underruns_;
+    // Used only in the writing thread
+    long long logged_underruns_;
+    // Samples written to / read from the buffer since the start. A flush moves the read position to the write position.
+    std::atomic<long long> write_position_;
+    std::atomic<long long> read_position_;
+    std::vector<std::pair<int, std::string>> devices_;
+    bool paused_;
+    bool quick_start_;
 };
 
 AudioDevice::AudioDevice()
@@ -191,6 +343,11 @@ AudioDevice::~AudioDevice()
 {
 }
 
+void AudioDevice::open()
+{
+    impl_->open();
+}
+
 int AudioDevice::getCurrentOutputDevice() const
 {
     return impl_->getCurrentOutputDevice();
@@ -206,9 +363,49 @@ int AudioDevice::getWriteAvailable() const
     return impl_->getWriteAvailable();
 }
 
-void AudioDevice::flush()
+long long AudioDevice::getNumUnderruns() const
+{
+    return impl_->getNumUnderruns();
+}
+
+const void* AudioDevice::getBufferMemory() const
+{
+    return impl_->getBufferMemory();
+}
+
+std::size_t AudioDevice::getBufferMemorySize() const
+{
+    return impl_->getBufferMemorySize();
+}
+
+long long AudioDevice::getWritePosition() const
+{
+    return impl_->getWritePosition();
+}
+
+long long AudioDevice::getReadPosition() const
+{
+    return impl_->getReadPosition();
+}
+
+void AudioDevice::flush(bool quick_start)
+{
+    impl_->flush(quick_start);
+}
+
+void AudioDevice::pause()
+{
+    impl_->pause();
+}
+
+void AudioDevice::resume()
+{
+    impl_->resume();
+}
+
+void AudioDevice::refreshOutputDevices()
 {
-    impl_->flush();
+    impl_->refreshOutputDevices();
 }
 
 void AudioDevice::setOutputDevice(int dev)
@@ -216,9 +413,14 @@ void AudioDevice::setOutputDevice(int dev)
     impl_->setOutputDevice(dev);
 }
 
-int AudioDevice::write(int sample_rate, int num_channels, const std::vector<int16_t>& audio_data)
+void AudioDevice::setOutputEqualizer(OutputEqualizer* eq)
+{
+    impl_->setOutputEqualizer(eq);
+}
+
+int AudioDevice::write(int sample_rate, int num_channels, const int16_t* audio_data, int num_samples)
 {
-    return impl_->write(sample_rate, num_channels, audio_data);
+    return impl_->write(sample_rate, num_channels, audio_data, num_samples);
 }
 
 }
@@ -1,6 +1,7 @@
 #ifndef SPOTIFY_BACKSTAGE_AUDIODEVICE_HPP
 #define SPOTIFY_BACKSTAGE_AUDIODEVICE_HPP
 
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <string>
@@ -9,19 +10,41 @@
 
 namespace spotify_backstage {
 
+class OutputEqualizer;
+
+// Audio output through PortAudio. PortAudio is initialized on first use, or with open(),
+// as probing the devices can take long.
 class AudioDevice
 {
 public:
     AudioDevice();
     ~AudioDevice();
 
+    void open();
+
     int getCurrentOutputDevice() const;
+    // The devices found when opened or on the latest refresh
     std::vector<std::pair<int, std::string>> getOutputDevices() const;
     int getWriteAvailable() const;
-
-    void flush();
+    long long getNumUnderruns() const;
+    // Memory of the buffer between the writer and the audio driver thread, allocated at construction
+    const void* getBufferMemory() const;
+    std::size_t getBufferMemorySize() const;
+    // Number of samples written to the buffer, and played from it, since the start.
+    // After a flush, the read position equals the write position.
+    long long getWritePosition() const;
+    long long getReadPosition() const;
+
+    // Drop the buffered audio. With quick_start, the output restarts with a short prebuffer.
+    void flush(bool quick_start = false);
+    // Stop the output, keeping the buffered audio. Returns when the audio already passed to the device has been played.
+    void pause();
+    void resume();
+    // Enumerate the devices again. PortAudio is reinitialized, and the current device is reopened by name.
+    void refreshOutputDevices();
     void setOutputDevice(int dev);
-    int write(int sample_rate, int num_channels, const std::vector<int16_t>& audio_data);
+    void setOutputEqualizer(OutputEqualizer* eq);
+    int write(int sample_rate, int num_channels, const int16_t* audio_data, int num_samples);
 
 private:
     class Impl;
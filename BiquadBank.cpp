@@ -0,0 +1,49 @@
+#include "BiquadBank.hpp"
+
+#include <algorithm>
+
+namespace spotify_backstage {
+
+const int BiquadBank::MAX_FILTERS;
+const int BiquadBank::LANES;
+
+BiquadBank::BiquadBank()
+  : num_lanes_(0), b0_(), b1_(), b2_(), a1_(), a2_(), z1_(), z2_(), gain_()
+{
+}
+
+void BiquadBank::setNumFilters(int num_filters)
+{
+    num_filters = std::max(0, std::min(num_filters, MAX_FILTERS));
+    num_lanes_ = (num_filters + LANES - 1) / LANES * LANES;
+
+    for (int i = num_filters; i < MAX_FILTERS; ++i)
+    {
+        setCoeffs(i, 0.0, 0.0, 0.0, 0.0, 0.0);
+        setGain(i, 0.0);
+    }
+
+    reset();
+}
+
+void BiquadBank::setCoeffs(int i, double b0, double b1, double b2, double a1, double a2)
+{
+    b0_[i] = b0;
+    b1_[i] = b1;
+    b2_[i] = b2;
+    a1_[i] = a1;
+    a2_[i] = a2;
+}
+
+void BiquadBank::setGain(int i, double gain)
+{
+    gain_[i] = gain;
+}
+
+void BiquadBank::reset()
+{
+    std::fill(z1_, z1_ + MAX_FILTERS, 0.0f);
+    std::fill(z2_, z2_ + MAX_FILTERS, 0.0f);
+}
+
+}
@@ -0,0 +1,80 @@
+#ifndef SPOTIFY_BACKSTAGE_BIQUADBANK_HPP
+#define SPOTIFY_BACKSTAGE_BIQUADBANK_HPP
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+namespace spotify_backstage {
+
+// Parallel bank of biquad filters, all fed with the same input. The output is the weighted sum of the filter outputs.
+// The filter coefficients and states are stored as arrays (one array per coefficient),
+// so that four filters are run at once in SIMD lanes.
+class BiquadBank
+{
+public:
+    static const int MAX_FILTERS = 32;
+
+    BiquadBank();
+
+    void setNumFilters(int num_filters);
+    void setCoeffs(int i, double b0, double b1, double b2, double a1, double a2);
+    void setGain(int i, double gain);
+    float filter(float sample);
+    void reset();
+
+private:
+    static const int LANES = 4;
+
+    // Number of filters in use, rounded up to LANES. The unused lanes have zero coefficients and gain.
+    int num_lanes_;
+
+    // Transposed Direct Form II coefficients and state, a0 normalized to 1
+    alignas(16) float b0_[MAX_FILTERS];
+    alignas(16) float b1_[MAX_FILTERS];
+    alignas(16) float b2_[MAX_FILTERS];
+    alignas(16) float a1_[MAX_FILTERS];
+    alignas(16) float a2_[MAX_FILTERS];
+    alignas(16) float z1_[MAX_FILTERS];
+    alignas(16) float z2_[MAX_FILTERS];
+    alignas(16) float gain_[MAX_FILTERS];
+};
+
+inline float BiquadBank::filter(float sample)
+{
+#if defined(__SSE__)
+    const auto x = _mm_set1_ps(sample);
+    auto acc = _mm_setzero_ps();
+
+    for (int i = 0; i < num_lanes_; i += LANES)
+    {
+        const auto y = _mm_add_ps(_mm_mul_ps(_mm_load_ps(b0_ + i), x), _mm_load_ps(z1_ + i));
+        _mm_store_ps(z1_ + i, _mm_add_ps(
+            _mm_sub_ps(_mm_mul_ps(_mm_load_ps(b1_ + i), x), _mm_mul_ps(_mm_load_ps(a1_ + i), y)),
+            _mm_load_ps(z2_ + i)));
+        _mm_store_ps(z2_ + i,
+            _mm_sub_ps(_mm_mul_ps(_mm_load_ps(b2_ + i), x), _mm_mul_ps(_mm_load_ps(a2_ + i), y)));
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_load_ps(gain_ + i), y));
+    }
+
+    alignas(16) float sum[LANES];
+    _mm_store_ps(sum, acc);
+    return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+#else
+    auto result = 0.0f;
+
+    for (int i = 0; i < num_lanes_; ++i)
+    {
+        const auto y = b0_[i] * sample + z1_[i];
+        z1_[i] = b1_[i] * sample - a1_[i] * y + z2_[i];
+        z2_[i] = b2_[i] * sample - a2_[i] * y;
+        result += gain_[i] * y;
+    }
+
+    return result;
+#endif
+}
+
+}
+
+#endif
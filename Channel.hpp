@@ -0,0 +1,189 @@
+#ifndef SPOTIFY_BACKSTAGE_CHANNEL_HPP
+#define SPOTIFY_BACKSTAGE_CHANNEL_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace spotify_backstage {
+
+// Message queue between threads, with two priority lanes.
+// The messages are stored in rings preallocated at construction, so passing a message doesn't allocate
+// while the ring has room. If a ring fills up, the messages spill over to a deque instead of blocking the sender,
+// as a thread may send messages to itself. The deque does allocate. Its messages move back to the ring
+// as the receiver frees slots.
+template<typename T>
+class Channel
+{
+public:
+    enum Lane
+    {
+        NORMAL,
+        // Served before anything in the normal lane
+        PRIORITY
+    };
+
+    explicit Channel(int capacity)
+      : mutex_(), not_empty_(), lanes_{Ring(capacity), Ring(capacity)}, num_overflows_(0)
+    {
+    }
+
+    void put(T&& msg, Lane lane = NORMAL)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!lanes_[lane].push(std::move(msg)))
+                ++num_overflows_;
+        }
+        not_empty_.notify_one();
+    }
+
+    // Get the next message. Returns false if no message arrived in timeout_ms (0 = wait forever).
+    bool get(T& msg, int timeout_ms = 0)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto has_msg = [this] { return !lanes_[PRIORITY].empty() || !lanes_[NORMAL].empty(); };
+
+        if (timeout_ms > 0)
+        {
+            if (!not_empty_.wait_for(lock, std::chrono::milliseconds(timeout_ms), has_msg))
+                return false;
+        }
+        else
+            not_empty_.wait(lock, has_msg);
+
+        lanes_[lanes_[PRIORITY].empty() ? NORMAL : PRIORITY].pop(msg);
+        return true;
+    }
+
+    // Get the next message without waiting. Returns false if there's none.
+    bool tryGet(T& msg)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (lanes_[PRIORITY].empty() && lanes_[NORMAL].empty())
+            return false;
+
+        lanes_[lanes_[PRIORITY].empty() ? NORMAL : PRIORITY].pop(msg);
+        return true;
+    }
+
+    // Number of messages that didn't fit to the ring
+    long long getNumOverflows() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return num_overflows_;
+    }
+
+private:
+    class Ring
+    {
+    public:
+        explicit Ring(int capacity) : slots_(capacity), head_(0), size_(0), overflow_()
+        {
+        }
+
+        // The overflow only has messages when the ring is full
+        bool empty() const
+        {
+            return size_ == 0;
+        }
+
+        // Returns false if the message went to the overflow
+        bool push(T&& msg)
+        {
+            // Behind the overflowed messages, to keep the order
+            if (size_ == static_cast<int>(slots_.size()))
+            {
+                overflow_.push_back(std::move(msg));
+                return false;
+            }
+
+            slots_[(head_ + size_) % slots_.size()] = std::move(msg);
+            ++size_;
+            return true;
+        }
+
+        void pop(T& msg)
+        {
+            msg = std::move(slots_[head_]);
+            head_ = (head_ + 1) % slots_.size();
+            --size_;
+
+            // The oldest overflowed message takes the freed slot, so the ring is in use again once the
+            // receiver catches up
+            if (!overflow_.empty())
+            {
+                slots_[(head_ + size_) % slots_.size()] = std::move(overflow_.front());
+                overflow_.pop_front();
+                ++size_;
+            }
+        }
+
+    private:
+        std::vector<T> slots_;
+        int head_;
+        int size_;
+        std::deque<T> overflow_;
+    };
+
+    mutable std::mutex mutex_;
+    std::condition_variable not_empty_;
+    Ring lanes_[2];
+    long long num_overflows_;
+};
+
+// Reply to a request sent through a Channel. The requester keeps the Reply in its stack, passes a pointer to it in
+// the request, and waits for the value.
+template<typename T>
+class Reply
+{
+public:
+    Reply() : mutex_(), ready_(), value_(), has_value_(false)
+    {
+    }
+
+    Reply(const Reply&) = delete;
+    Reply& operator=(const Reply&) = delete;
+
+    ~Reply()
+    {
+        if (has_value_)
+            get().~T();
+    }
+
+    void set(T value)
+    {
+        // Notified with the lock held, as the requester may destroy the Reply as soon as it sees the value
+        std::lock_guard<std::mutex> lock(mutex_);
+        new (&value_) T(std::move(value));
+        has_value_ = true;
+        ready_.notify_one();
+    }
+
+    T wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this] { return has_value_; });
+        return std::move(get());
+    }
+
+private:
+    T& get()
+    {
+        return *reinterpret_cast<T*>(&value_);
+    }
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type value_;
+    bool has_value_;
+};
+
+}
+
+#endif
@@ -0,0 +1,256 @@
+#include "Convolver.hpp"
+
+#include "Fft.hpp"
+#include "Logger.hpp"
+#include <algorithm>
+#include <complex>
+#include <limits>
+
+namespace spotify_backstage {
+
+namespace {
+// Partition length in frames. This is also the latency of the filter.
+const int PARTITION_SIZE = 512;
+const int FFT_SIZE = 2 * PARTITION_SIZE;
+// Only the non-negative frequencies are stored, the input is real
+const int NUM_BINS = PARTITION_SIZE + 1;
+
+typedef std::vector<std::complex<float>> Spectrum;
+}
+
+class Convolver::Impl
+{
+public:
+    Impl()
+      : fft_(FFT_SIZE),
+        response_channels_(0),
+        response_sample_rate_(0),
+        partitions_(),
+        channels_(),
+        pos_(0),
+        fft_buffer_(FFT_SIZE),
+        accumulator_(NUM_BINS),
+        rate_mismatch_logged_(false)
+    {
+    }
+
+    ~Impl()
+    {
+    }
+
+    bool isEnabled() const
+    {
+        return response_channels_ > 0;
+    }
+
+    int getLatency() const
+    {
+        return isEnabled() ? PARTITION_SIZE : 0;
+    }
+
+    void process(int16_t* audio_data, int num_samples, int num_channels, int sample_rate)
+    {
+        if (!isEnabled())
+            return;
+
+        if (sample_rate != response_sample_rate_)
+        {
+            if (!rate_mismatch_logged_)
+                LOG("Impulse response sample rate " << response_sample_rate_ << " doesn't match " << sample_rate << ", bypassing");
+
+            rate_mismatch_logged_ = true;
+            return;
+        }
+
+        if (num_channels != static_cast<int>(channels_.size()))
+        {
+            LOG("Change in Convolver channel count: " << num_channels);
+            channels_.assign(num_channels, Channel(partitions_[0].size()));
+            pos_ = 0;
+        }
+
+        // Collect the input to the second half of each channel's input buffer, and output the
+        // result of the previous partition meanwhile
+        for (int i = 0; i + num_channels <= num_samples; i += num_channels)
+        {
+            for (int ch = 0; ch < num_channels; ++ch)
+            {
+                auto& channel = channels_[ch];
+                channel.input[PARTITION_SIZE + pos_] = audio_data[i + ch];
+                audio_data[i + ch] = limitToRange(channel.output[pos_]);
+            }
+
+            if (++pos_ == PARTITION_SIZE)
+            {
+                for (int ch = 0; ch < num_channels; ++ch)
+                    filterPartition(channels_[ch], partitions_[ch % response_channels_]);
+
+                pos_ = 0;
+            }
+        }
+    }
+
+    void reset()
+    {
+        for (auto& channel : channels_)
+            channel = Channel(channel.delay_line.size());
+
+        pos_ = 0;
+    }
+
+    void setImpulseResponse(const std::vector<float>& response, int num_channels, int sample_rate)
+    {
+        channels_.clear();
+        partitions_.clear();
+        pos_ = 0;
+        rate_mismatch_logged_ = false;
+
+        const int length = num_channels > 0 ? response.size() / num_channels : 0;
+        if (length == 0)
+        {
+            response_channels_ = 0;
+            return;
+        }
+
+        response_channels_ = num_channels;
+        response_sample_rate_ = sample_rate;
+
+        const auto num_partitions = (length + PARTITION_SIZE - 1) / PARTITION_SIZE;
+        partitions_.assign(num_channels, std::vector<Spectrum>(num_partitions));
+
+        for (int ch = 0; ch < num_channels; ++ch)
+        {
+            for (int p = 0; p < num_partitions; ++p)
+            {
+                // Each partition is zero padded to FFT size
+                std::fill(fft_buffer_.begin(), fft_buffer_.end(), std::complex<float>());
+                for (int i = 0; i < PARTITION_SIZE && p * PARTITION_SIZE + i < length; ++i)
+                    fft_buffer_[i] = response[(p * PARTITION_SIZE + i) * num_channels + ch];
+
+                fft_.forward(fft_buffer_);
+                partitions_[ch][p].assign(fft_buffer_.begin(), fft_buffer_.begin() + NUM_BINS);
+            }
+        }
+
+        LOG("Impulse response set: " << length << " frames, " << num_channels << " channels, " <<
+            num_partitions << " partitions");
+    }
+
+private:
+    struct Channel
+    {
+        Channel(int num_partitions)
+          : input(FFT_SIZE, 0.0f), output(PARTITION_SIZE, 0.0f), delay_line(num_partitions, Spectrum(NUM_BINS)), head(0)
+        {
+        }
+
+        // Previous and current partition of input
+        std::vector<float> input;
+        // Output for the partition being collected
+        std::vector<float> output;
+        // Spectra of the latest inputs, used as circular buffer. head is the latest.
+        std::vector<Spectrum> delay_line;
+        int head;
+    };
+
+    // Overlap-save: transform the last two partitions of input, multiply-accumulate with each
+    // impulse response partition the input spectrum from that many partitions ago, and take the
+    // second half of the inverse transform
+    void filterPartition(Channel& channel, const std::vector<Spectrum>& response)
+    {
+        const int num_partitions = channel.delay_line.size();
+
+        for (int i = 0; i < FFT_SIZE; ++i)
+            fft_buffer_[i] = channel.input[i];
+
+        fft_.forward(fft_buffer_);
+
+        channel.head = (channel.head + 1) % num_partitions;
+        std::copy(fft_buffer_.begin(), fft_buffer_.begin() + NUM_BINS, channel.delay_line[channel.head].begin());
+
+        std::fill(accumulator_.begin(), accumulator_.end(), std::complex<float>());
+        for (int p = 0; p < num_partitions; ++p)
+        {
+            const auto& x = channel.delay_line[(channel.head + num_partitions - p) % num_partitions];
+            const auto& h = response[p];
+
+            for (int k = 0; k < NUM_BINS; ++k)
+            {
+                const auto re = x[k].real() * h[k].real() - x[k].imag() * h[k].imag();
+                const auto im = x[k].real() * h[k].imag() + x[k].imag() * h[k].real();
+                accumulator_[k] = std::complex<float>(accumulator_[k].real() + re, accumulator_[k].imag() + im);
+            }
+        }
+
+        // Restore the negative frequencies from the conjugate symmetry
+        std::copy(accumulator_.begin(), accumulator_.end(), fft_buffer_.begin());
+        for (int k = 1; k < PARTITION_SIZE; ++k)
+            fft_buffer_[FFT_SIZE - k] = std::conj(accumulator_[k]);
+
+        fft_.inverse(fft_buffer_);
+
+        for (int i = 0; i < PARTITION_SIZE; ++i)
+            channel.output[i] = fft_buffer_[PARTITION_SIZE + i].real();
+
+        std::copy(channel.input.begin() + PARTITION_SIZE, channel.input.end(), channel.input.begin());
+    }
+
+    static int16_t limitToRange(float val)
+    {
+        static const auto min = std::numeric_limits<int16_t>::min();
+        static const auto max = std::numeric_limits<int16_t>::max();
+
+        if (val < min) return min;
+        if (val > max) return max;
+
+        return static_cast<int16_t>(val);
+    }
+
+    Fft fft_;
+    int response_channels_;
+    int response_sample_rate_;
+    // Spectra of the impulse response partitions, per impulse response channel
+    std::vector<std::vector<Spectrum>> partitions_;
+    std::vector<Channel> channels_;
+    // Position in the partition being collected
+    int pos_;
+    Spectrum fft_buffer_;
+    Spectrum accumulator_;
+    bool rate_mismatch_logged_;
+};
+
+Convolver::Convolver()
+  : impl_(new Impl)
+{
+}
+
+Convolver::~Convolver()
+{
+}
+
+bool Convolver::isEnabled() const
+{
+    return impl_->isEnabled();
+}
+
+int Convolver::getLatency() const
+{
+    return impl_->getLatency();
+}
+
+void Convolver::process(int16_t* audio_data, int num_samples, int num_channels, int sample_rate)
+{
+    impl_->process(audio_data, num_samples, num_channels, sample_rate);
+}
+
+void Convolver::reset()
+{
+    impl_->reset();
+}
+
+void Convolver::setImpulseResponse(const std::vector<float>& response, int num_channels, int sample_rate)
+{
+    impl_->setImpulseResponse(response, num_channels, sample_rate);
+}
+
+}
@@ -0,0 +1,35 @@
+#ifndef SPOTIFY_BACKSTAGE_CONVOLVER_HPP
+#define SPOTIFY_BACKSTAGE_CONVOLVER_HPP
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace spotify_backstage {
+
+// FIR filter for long impulse responses (e.g. room correction), implemented as
+// uniformly partitioned overlap-save convolution with a frequency-domain delay line.
+// The output is delayed by one partition (getLatency() frames).
+class Convolver
+{
+public:
+    Convolver();
+    ~Convolver();
+
+    bool isEnabled() const;
+    int getLatency() const;
+
+    void process(int16_t* audio_data, int num_samples, int num_channels, int sample_rate);
+    void reset();
+    // Set the impulse response, channels interleaved. A mono response is used for all the channels.
+    // Empty response disables the filter.
+    void setImpulseResponse(const std::vector<float>& response, int num_channels, int sample_rate);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+}
+
+#endif
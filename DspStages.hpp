@@ -0,0 +1,157 @@
+#ifndef SPOTIFY_BACKSTAGE_DSPSTAGES_HPP
+#define SPOTIFY_BACKSTAGE_DSPSTAGES_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+// Stages for SampleChain. They're defined in the header, so that the chain can inline them.
+// The parameters can be set from any thread. They take effect from the next block.
+
+namespace spotify_backstage {
+
+// Multiplies the samples by a gain
+class GainStage
+{
+public:
+    GainStage() : target_(1.0f), gain_(1.0f)
+    {
+    }
+
+    void setGain(double gain)
+    {
+        target_ = static_cast<float>(gain);
+    }
+
+    void prepare(int, int)
+    {
+        gain_ = target_;
+    }
+
+    float process(float sample, int)
+    {
+        return sample * gain_;
+    }
+
+    void reset()
+    {
+    }
+
+private:
+    std::atomic<float> target_;
+    float gain_;
+};
+
+// Peak limiter. Peaks above the threshold are caught instantly, and the gain recovers over the release time,
+// so the output never exceeds the threshold.
+class LimiterStage
+{
+public:
+    static const int MAX_CHANNELS = 8;
+
+    LimiterStage() : target_threshold_(1.0f), threshold_(1.0f), release_ms_(50.0f), release_(0.0f), envelope_()
+    {
+        reset();
+    }
+
+    // Threshold in linear scale, 1.0 = full scale
+    void setThreshold(double threshold)
+    {
+        target_threshold_ = static_cast<float>(threshold);
+    }
+
+    void setRelease(double release_ms)
+    {
+        release_ms_ = static_cast<float>(release_ms);
+    }
+
+    void prepare(int, int sample_rate)
+    {
+        threshold_ = target_threshold_;
+        release_ = std::exp(-1000.0f / (std::max(1.0f, release_ms_.load()) * sample_rate));
+    }
+
+    float process(float sample, int channel)
+    {
+        auto& envelope = envelope_[std::min(channel, MAX_CHANNELS - 1)];
+        envelope = std::max(std::fabs(sample), envelope * release_);
+        return envelope > threshold_ ? sample * threshold_ / envelope : sample;
+    }
+
+    void reset()
+    {
+        std::fill(envelope_, envelope_ + MAX_CHANNELS, 0.0f);
+    }
+
+private:
+    std::atomic<float> target_threshold_;
+    float threshold_;
+    std::atomic<float> release_ms_;
+    // Envelope decay per sample
+    float release_;
+    float envelope_[MAX_CHANNELS];
+};
+
+// Measures the level of the audio passing through, without changing it
+class LevelMeterStage
+{
+public:
+    LevelMeterStage() : peak_(0.0f), rms_(0.0f), block_peak_(0.0f), block_sum_(0.0), block_samples_(0)
+    {
+    }
+
+    // Highest peak since the previous call, in linear scale
+    float takePeak()
+    {
+        return peak_.exchange(0.0f);
+    }
+
+    // RMS level of the latest finished block, in linear scale
+    float getRms() const
+    {
+        return rms_;
+    }
+
+    void prepare(int, int)
+    {
+        // Publish the previous block
+        if (block_samples_ > 0)
+        {
+            auto peak = peak_.load();
+            while (block_peak_ > peak && !peak_.compare_exchange_weak(peak, block_peak_))
+            {
+            }
+            rms_ = static_cast<float>(std::sqrt(block_sum_ / block_samples_));
+        }
+
+        block_peak_ = 0.0f;
+        block_sum_ = 0.0;
+        block_samples_ = 0;
+    }
+
+    float process(float sample, int)
+    {
+        block_peak_ = std::max(block_peak_, std::fabs(sample));
+        block_sum_ += sample * sample;
+        ++block_samples_;
+        return sample;
+    }
+
+    void reset()
+    {
+        block_peak_ = 0.0f;
+        block_sum_ = 0.0;
+        block_samples_ = 0;
+    }
+
+private:
+    std::atomic<float> peak_;
+    std::atomic<float> rms_;
+    float block_peak_;
+    double block_sum_;
+    long block_samples_;
+};
+
+}
+
+#endif
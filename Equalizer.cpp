@@ -2,6 +2,9 @@
 
 #include "FilterBank.hpp"
 #include "Logger.hpp"
+#include "WorkerPool.hpp"
+#include <algorithm>
+#include <thread>
 
 namespace spotify_backstage {
 
@@ -13,16 +16,38 @@ const std::vector<double> midCoeffsA = { 1.0, -4.460479873873305, 8.336970524397
 const std::vector<double> midCoeffsB = { 0.028635300170904, 0.0, -0.085905900512713, 0.0, 0.085905900512713, 0.0, -0.028635300170904 };
 const std::vector<double> trebleCoeffsA = { 1.0, -1.459029062228061, 0.910369000290069, -0.197825187264320 };
 const std::vector<double> trebleCoeffsB = { 0.445902906222806, -1.337708718668418, 1.337708718668418, -0.445902906222806 };
+
+// Blocks with at least PARALLEL_MIN_CHANNELS channels and PARALLEL_MIN_SAMPLES samples are filtered in parallel.
+// Below that, waking up the workers costs more than it saves.
+const int PARALLEL_MIN_CHANNELS = 3;
+const int PARALLEL_MIN_SAMPLES = 8192;
+const int MAX_THREADS = 4;
 }
 
 class Equalizer::Impl
 {
 public:
     Impl()
-      : banks_(), gain_(1.0), bass_(1.0), mid_(1.0), treble_(1.0)
+      : banks_(),
+        gain_(1.0),
+        bass_(1.0),
+        mid_(1.0),
+        treble_(1.0),
+        max_threads_(std::max(1, std::min<int>(MAX_THREADS, std::thread::hardware_concurrency()))),
+        workers_(),
+        thread_init_(),
+        channel_job_([this](int task) { filterChannels(task); }),
+        channel_buffers_(),
+        block_data_(nullptr),
+        block_frames_(0),
+        num_tasks_(0)
     {
         init(2);
     }
+
+    // channel_job_ refers to this, and the block pointer is only valid during equalize()
+    Impl(const Impl&) = delete;
+    Impl& operator=(const Impl&) = delete;
     
     ~Impl()
     {
@@ -66,7 +91,7 @@ public:
         return treble_;
     }
 
-    void equalize(std::vector<int16_t>& audio_data, int num_channels)
+    void equalize(int16_t* audio_data, int num_samples, int num_channels)
     {
         if (num_channels != static_cast<int>(banks_.size()))
         {
@@ -74,7 +99,13 @@ public:
             init(num_channels);
         }
         
-        for (int i = 0; i < static_cast<int>(audio_data.size()); ++i)
+        if (num_channels >= PARALLEL_MIN_CHANNELS && num_samples >= PARALLEL_MIN_SAMPLES && max_threads_ > 1)
+        {
+            equalizeParallel(audio_data, num_samples, num_channels);
+            return;
+        }
+
+        for (int i = 0; i < num_samples; ++i)
             audio_data[i] = banks_[i % banks_.size()].filter(audio_data[i]);
     }
     
@@ -84,6 +115,12 @@ public:
             bank.reset();
     }
     
+    void prepare(int num_channels)
+    {
+        if (num_channels != static_cast<int>(banks_.size()))
+            init(num_channels);
+    }
+
     void setGain(double gain)
     {
         gain_ = gain;
@@ -112,7 +149,56 @@ public:
             bank.setGain(TREBLE_ID, treble_);
     }
 
+    void setMaxThreads(int max_threads)
+    {
+        max_threads_ = std::max(1, max_threads);
+        workers_.reset();
+    }
+
+    void setThreadInit(const std::function<void()>& thread_init)
+    {
+        thread_init_ = thread_init;
+        workers_.reset();
+    }
+
 private:
+    // Each task deinterleaves and filters a group of channels to channel_buffers_.
+    // The block is interleaved back once all the tasks are done.
+    void equalizeParallel(int16_t* audio_data, int num_samples, int num_channels)
+    {
+        if (!workers_)
+        {
+            LOG("Starting " << max_threads_ << " equalizer threads");
+            workers_.reset(new WorkerPool(max_threads_, thread_init_));
+        }
+
+        block_data_ = audio_data;
+        block_frames_ = num_samples / num_channels;
+        num_tasks_ = std::min(num_channels, workers_->getNumThreads());
+
+        channel_buffers_.resize(num_channels);
+        for (auto& buffer : channel_buffers_)
+            buffer.resize(block_frames_);
+
+        workers_->run(channel_job_, num_tasks_);
+
+        for (int ch = 0; ch < num_channels; ++ch)
+            for (int i = 0; i < block_frames_; ++i)
+                audio_data[i * num_channels + ch] = channel_buffers_[ch][i];
+    }
+
+    void filterChannels(int task)
+    {
+        const int num_channels = banks_.size();
+        for (int ch = task; ch < num_channels; ch += num_tasks_)
+        {
+            auto& bank = banks_[ch];
+            auto& buffer = channel_buffers_[ch];
+            for (int i = 0; i < block_frames_; ++i)
+                buffer[i] = bank.filter(block_data_[i * num_channels + ch]);
+        }
+    }
+
     enum
     {
         BASS_ID,
@@ -125,6 +211,15 @@ private:
     double bass_;
     double mid_;
     double treble_;
+    int max_threads_;
+    std::unique_ptr<WorkerPool> workers_;
+    std::function<void()> thread_init_;
+    std::function<void(int)> channel_job_;
+    std::vector<std::vector<int16_t>> channel_buffers_;
+    // The block being filtered in parallel
+    int16_t* block_data_;
+    int block_frames_;
+    int num_tasks_;
 };
 
 Equalizer::Equalizer()
@@ -158,7 +253,12 @@ double Equalizer::getTreble() const
 
 void Equalizer::equalize(std::vector<int16_t>& audio_data, int num_channels)
 {
-    impl_->equalize(audio_data, num_channels);
+    impl_->equalize(audio_data.data(), audio_data.size(), num_channels);
+}
+
+void Equalizer::equalize(int16_t* audio_data, int num_samples, int num_channels)
+{
+    impl_->equalize(audio_data, num_samples, num_channels);
 }
 
 void Equalizer::reset()
@@ -166,6 +266,11 @@ void Equalizer::reset()
     impl_->reset();
 }
 
+void Equalizer::prepare(int num_channels)
+{
+    impl_->prepare(num_channels);
+}
+
 void Equalizer::setGain(double gain)
 {
     impl_->setGain(gain);
@@ -186,4 +291,14 @@ void Equalizer::setTreble(double treble)
     impl_->setTreble(treble);
 }
 
+void Equalizer::setMaxThreads(int max_threads)
+{
+    impl_->setMaxThreads(max_threads);
+}
+
+void Equalizer::setThreadInit(const std::function<void()>& thread_init)
+{
+    impl_->setThreadInit(thread_init);
+}
+
 }
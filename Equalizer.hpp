@@ -2,6 +2,7 @@
 #define SPOTIFY_BACKSTAGE_EQUALIZER_HPP
 
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -21,11 +22,17 @@ public:
     double getTreble() const;
 
     void equalize(std::vector<int16_t>& audio_data, int num_channels);
+    void equalize(int16_t* audio_data, int num_samples, int num_channels);
     void reset();
+    // Set up the filters for blocks of num_channels channels, so that equalize() doesn't need to. Resets the gains.
+    void prepare(int num_channels);
     void setGain(double gain);
     void setBass(double bass);
     void setMid(double mid);
     void setTreble(double treble);
+    void setMaxThreads(int max_threads);
+    // Called at the start of each thread filtering channels in parallel, to set it up like the calling thread
+    void setThreadInit(const std::function<void()>& thread_init);
 
 private:
     class Impl;
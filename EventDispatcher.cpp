@@ -0,0 +1,165 @@
+#include "EventDispatcher.hpp"
+
+#include <atomic>
+#include <boost/lockfree/queue.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace spotify_backstage {
+
+namespace {
+const int QUEUE_SIZE = 1024;
+}
+
+class EventDispatcher::Impl
+{
+public:
+    Impl()
+      : queue_(),
+        subscribers_mutex_(),
+        subscribers_(std::make_shared<const Subscribers>()),
+        next_id_(0),
+        num_dropped_(0),
+        wake_mutex_(),
+        wake_(),
+        sleeping_(false),
+        terminate_(false),
+        thread_(&Impl::run, this)
+    {
+    }
+
+    ~Impl()
+    {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            terminate_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+    }
+
+    int subscribe(const EventCallback& callback)
+    {
+        std::lock_guard<std::mutex> lock(subscribers_mutex_);
+        auto subscribers = std::make_shared<Subscribers>(*subscribers_);
+        const auto id = next_id_++;
+        (*subscribers)[id] = callback;
+        subscribers_ = subscribers;
+        return id;
+    }
+
+    void unsubscribe(int id)
+    {
+        std::lock_guard<std::mutex> lock(subscribers_mutex_);
+        auto subscribers = std::make_shared<Subscribers>(*subscribers_);
+        subscribers->erase(id);
+        subscribers_ = subscribers;
+    }
+
+    void post(Event::Type type, long long value)
+    {
+        if (!queue_.bounded_push(Event(type, value)))
+        {
+            ++num_dropped_;
+            return;
+        }
+
+        // Only take the lock when the dispatcher thread is waiting for events
+        if (sleeping_.exchange(false))
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            wake_.notify_one();
+        }
+    }
+
+    long long getNumDropped() const
+    {
+        return num_dropped_;
+    }
+
+private:
+    typedef std::map<int, EventCallback> Subscribers;
+
+    void run()
+    {
+        while (true)
+        {
+            Event event;
+            while (queue_.pop(event))
+                dispatch(event);
+
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            if (terminate_)
+                break;
+
+            sleeping_ = true;
+            if (!queue_.empty())
+            {
+                sleeping_ = false;
+                continue;
+            }
+
+            // The timeout is only a safety net, post() wakes the thread
+            wake_.wait_for(lock, std::chrono::milliseconds(100), [this] { return !sleeping_ || terminate_; });
+            sleeping_ = false;
+        }
+    }
+
+    void dispatch(const Event& event)
+    {
+        // Subscribers are copy-on-write, so the callbacks can (un)subscribe
+        std::shared_ptr<const Subscribers> subscribers;
+        {
+            std::lock_guard<std::mutex> lock(subscribers_mutex_);
+            subscribers = subscribers_;
+        }
+
+        for (const auto& subscriber : *subscribers)
+            subscriber.second(event);
+    }
+
+    boost::lockfree::queue<Event, boost::lockfree::capacity<QUEUE_SIZE>> queue_;
+    std::mutex subscribers_mutex_;
+    std::shared_ptr<const Subscribers> subscribers_;
+    int next_id_;
+    std::atomic<long long> num_dropped_;
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::atomic<bool> sleeping_;
+    bool terminate_;
+    std::thread thread_;
+};
+
+EventDispatcher::EventDispatcher()
+  : impl_(new Impl())
+{
+}
+
+EventDispatcher::~EventDispatcher()
+{
+}
+
+int EventDispatcher::subscribe(const EventCallback& callback)
+{
+    return impl_->subscribe(callback);
+}
+
+void EventDispatcher::unsubscribe(int id)
+{
+    impl_->unsubscribe(id);
+}
+
+void EventDispatcher::post(Event::Type type, long long value)
+{
+    impl_->post(type, value);
+}
+
+long long EventDispatcher::getNumDropped() const
+{
+    return impl_->getNumDropped();
+}
+
+}
@@ -0,0 +1,33 @@
+#ifndef SPOTIFY_BACKSTAGE_EVENTDISPATCHER_HPP
+#define SPOTIFY_BACKSTAGE_EVENTDISPATCHER_HPP
+
+#include "SpotifyBackstage.hpp"
+#include <memory>
+
+namespace spotify_backstage {
+
+// Delivers events to the subscribers from a dedicated thread.
+// Events are passed to the thread through a bounded lock-free queue, so post() never allocates or waits
+// for the subscribers. If the queue is full, the event is dropped.
+class EventDispatcher
+{
+public:
+    EventDispatcher();
+    ~EventDispatcher();
+
+    int subscribe(const EventCallback& callback);
+    void unsubscribe(int id);
+
+    // Can be called from any thread
+    void post(Event::Type type, long long value = 0);
+
+    long long getNumDropped() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+}
+
+#endif
@@ -0,0 +1,89 @@
+#include "Fft.hpp"
+
+#include "Logger.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <utility>
+
+namespace spotify_backstage {
+
+Fft::Fft(int size)
+  : size_(size), bit_reverse_(size), twiddles_(size / 2)
+{
+    if (size < 2 || (size & (size - 1)) != 0)
+    {
+        LOG("FFT size must be a power of two");
+        std::exit(1);
+    }
+
+    int num_bits = 0;
+    while ((1 << num_bits) < size)
+        ++num_bits;
+
+    for (int i = 0; i < size; ++i)
+    {
+        int reversed = 0;
+        for (int b = 0; b < num_bits; ++b)
+            if (i & (1 << b))
+                reversed |= 1 << (num_bits - 1 - b);
+
+        bit_reverse_[i] = reversed;
+    }
+
+    for (int k = 0; k < size / 2; ++k)
+    {
+        const auto phase = -2.0 * M_PI * k / size;
+        twiddles_[k] = std::complex<float>(std::cos(phase), std::sin(phase));
+    }
+}
+
+int Fft::getSize() const
+{
+    return size_;
+}
+
+void Fft::forward(std::vector<std::complex<float>>& data) const
+{
+    transform(data, false);
+}
+
+void Fft::inverse(std::vector<std::complex<float>>& data) const
+{
+    transform(data, true);
+
+    const auto scale = 1.0f / size_;
+    for (auto& x : data)
+        x *= scale;
+}
+
+void Fft::transform(std::vector<std::complex<float>>& data, bool inverse) const
+{
+    for (int i = 0; i < size_; ++i)
+        if (i < bit_reverse_[i])
+            std::swap(data[i], data[bit_reverse_[i]]);
+
+    // Butterflies written out with real arithmetic, std::complex multiplication is slow without -ffast-math
+    for (int len = 2; len <= size_; len *= 2)
+    {
+        const auto half = len / 2;
+        const auto step = size_ / len;
+
+        for (int start = 0; start < size_; start += len)
+        {
+            for (int k = 0; k < half; ++k)
+            {
+                const auto& w = twiddles_[k * step];
+                const auto w_im = inverse ? -w.imag() : w.imag();
+                auto& a = data[start + k];
+                auto& b = data[start + k + half];
+
+                const auto t_re = b.real() * w.real() - b.imag() * w_im;
+                const auto t_im = b.real() * w_im + b.imag() * w.real();
+                b = std::complex<float>(a.real() - t_re, a.imag() - t_im);
+                a = std::complex<float>(a.real() + t_re, a.imag() + t_im);
+            }
+        }
+    }
+}
+
+}
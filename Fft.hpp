@@ -0,0 +1,32 @@
+#ifndef SPOTIFY_BACKSTAGE_FFT_HPP
+#define SPOTIFY_BACKSTAGE_FFT_HPP
+
+#include <complex>
+#include <vector>
+
+namespace spotify_backstage {
+
+// In-place radix-2 complex FFT of a fixed power of two size
+class Fft
+{
+public:
+    explicit Fft(int size);
+
+    int getSize() const;
+
+    void forward(std::vector<std::complex<float>>& data) const;
+    // Inverse transform, scaled by 1/size
+    void inverse(std::vector<std::complex<float>>& data) const;
+
+private:
+    void transform(std::vector<std::complex<float>>& data, bool inverse) const;
+
+    int size_;
+    std::vector<int> bit_reverse_;
+    // exp(-2*pi*i*k/size), k = 0..size/2-1
+    std::vector<std::complex<float>> twiddles_;
+};
+
+}
+
+#endif
@@ -0,0 +1,228 @@
+#include "GraphicEqualizer.hpp"
+
+#include "BiquadBank.hpp"
+#include "Logger.hpp"
+#include <cmath>
+#include <limits>
+
+namespace spotify_backstage {
+
+namespace {
+// ISO 266 preferred frequencies
+const std::vector<double> octaveFrequencies = {
+    31.5, 63, 125, 250, 500, 1000, 2000, 4000, 8000, 16000 };
+const std::vector<double> thirdOctaveFrequencies = {
+    20, 25, 31.5, 40, 50, 63, 80, 100, 125, 160, 200, 250, 315, 400, 500, 630,
+    800, 1000, 1250, 1600, 2000, 2500, 3150, 4000, 5000, 6300, 8000, 10000, 12500, 16000, 20000 };
+
+// Q of a band-pass filter one octave / third octave wide
+const double octaveQ = 1.414;
+const double thirdOctaveQ = 4.318;
+
+// Keeps the filter states out of the denormal range in silence
+const float antiDenormal = 1e-20f;
+}
+
+class GraphicEqualizer::Impl
+{
+public:
+    Impl()
+      : banks_(1), sample_rate_(44100), band_gains_(), gain_(1.0)
+    {
+    }
+
+    ~Impl()
+    {
+    }
+
+    int getNumBands() const
+    {
+        return band_gains_.size();
+    }
+
+    std::vector<double> getBandGains() const
+    {
+        return band_gains_;
+    }
+
+    double getGain() const
+    {
+        return gain_;
+    }
+
+    // Each band is a band-pass filter with unity gain at the center frequency, and the output is
+    // x + sum((gain_i - 1) * bandpass_i(x)). With all gains at 1.0 the output equals the input,
+    // and a single band at its center frequency gets exactly its gain.
+    void equalize(int16_t* audio_data, int num_samples, int num_channels, int sample_rate)
+    {
+        if (num_channels != static_cast<int>(banks_.size()) || sample_rate != sample_rate_)
+        {
+            LOG("Change in GraphicEqualizer channel count / sample rate: " << num_channels << ", " << sample_rate);
+            prepare(num_channels, sample_rate);
+        }
+
+        const auto gain = static_cast<float>(gain_);
+        for (int i = 0; i + num_channels <= num_samples; i += num_channels)
+        {
+            for (int ch = 0; ch < num_channels; ++ch)
+            {
+                const auto x = static_cast<float>(audio_data[i + ch]);
+                audio_data[i + ch] = limitToRange(gain * (x + banks_[ch].filter(x + antiDenormal)));
+            }
+        }
+    }
+
+    void reset()
+    {
+        for (auto& bank : banks_)
+            bank.reset();
+    }
+
+    void prepare(int num_channels, int sample_rate)
+    {
+        banks_.resize(num_channels);
+        sample_rate_ = sample_rate;
+        configure();
+    }
+
+    bool setNumBands(int num_bands)
+    {
+        if (num_bands != 10 && num_bands != 31)
+        {
+            LOG("Unsupported number of graphic equalizer bands: " << num_bands);
+            return false;
+        }
+
+        band_gains_.assign(num_bands, 1.0);
+        configure();
+        return true;
+    }
+
+    void setBandGain(int band, double gain)
+    {
+        if (band < 0 || band >= static_cast<int>(band_gains_.size()))
+            return;
+
+        band_gains_[band] = gain;
+        for (auto& bank : banks_)
+            bank.setGain(band, gain - 1.0);
+    }
+
+    void setGain(double gain)
+    {
+        gain_ = gain;
+    }
+
+private:
+    // Calculate the band-pass coefficients for the current band count and sample rate
+    void configure()
+    {
+        const auto frequencies = getBandFrequencies(band_gains_.size());
+        const auto q = band_gains_.size() == 10 ? octaveQ : thirdOctaveQ;
+
+        for (auto& bank : banks_)
+        {
+            bank.setNumFilters(band_gains_.size());
+
+            for (int i = 0; i < static_cast<int>(frequencies.size()); ++i)
+            {
+                // Bands at or above Nyquist frequency are left out
+                if (frequencies[i] >= 0.5 * sample_rate_)
+                {
+                    bank.setCoeffs(i, 0.0, 0.0, 0.0, 0.0, 0.0);
+                    continue;
+                }
+
+                // Band-pass with 0 dB peak gain, from Robert Bristow-Johnson's Audio EQ Cookbook
+                const auto w0 = 2.0 * M_PI * frequencies[i] / sample_rate_;
+                const auto alpha = std::sin(w0) / (2.0 * q);
+                const auto a0 = 1.0 + alpha;
+                bank.setCoeffs(i, alpha / a0, 0.0, -alpha / a0, -2.0 * std::cos(w0) / a0, (1.0 - alpha) / a0);
+                bank.setGain(i, band_gains_[i] - 1.0);
+            }
+        }
+    }
+
+    static int16_t limitToRange(float val)
+    {
+        static const auto min = std::numeric_limits<int16_t>::min();
+        static const auto max = std::numeric_limits<int16_t>::max();
+
+        if (val < min) return min;
+        if (val > max) return max;
+
+        return static_cast<int16_t>(val);
+    }
+
+    std::vector<BiquadBank> banks_;
+    int sample_rate_;
+    std::vector<double> band_gains_;
+    double gain_;
+};
+
+GraphicEqualizer::GraphicEqualizer()
+  : impl_(new Impl)
+{
+}
+
+GraphicEqualizer::~GraphicEqualizer()
+{
+}
+
+std::vector<double> GraphicEqualizer::getBandFrequencies(int num_bands)
+{
+    if (num_bands == 10)
+        return octaveFrequencies;
+
+    if (num_bands == 31)
+        return thirdOctaveFrequencies;
+
+    return std::vector<double>();
+}
+
+int GraphicEqualizer::getNumBands() const
+{
+    return impl_->getNumBands();
+}
+
+std::vector<double> GraphicEqualizer::getBandGains() const
+{
+    return impl_->getBandGains();
+}
+
+double GraphicEqualizer::getGain() const
+{
+    return impl_->getGain();
+}
+
+void GraphicEqualizer::equalize(int16_t* audio_data, int num_samples, int num_channels, int sample_rate)
+{
+    impl_->equalize(audio_data, num_samples, num_channels, sample_rate);
+}
+
+void GraphicEqualizer::reset()
+{
+    impl_->reset();
+}
+
+void GraphicEqualizer::prepare(int num_channels, int sample_rate)
+{
+    impl_->prepare(num_channels, sample_rate);
+}
+
+bool GraphicEqualizer::setNumBands(int num_bands)
+{
+    return impl_->setNumBands(num_bands);
+}
+
+void GraphicEqualizer::setBandGain(int band, double gain)
+{
+    impl_->setBandGain(band, gain);
+}
+
+void GraphicEqualizer::setGain(double gain)
+{
+    impl_->setGain(gain);
+}
+
+}
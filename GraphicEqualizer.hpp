@@ -0,0 +1,39 @@
+#ifndef SPOTIFY_BACKSTAGE_GRAPHICEQUALIZER_HPP
+#define SPOTIFY_BACKSTAGE_GRAPHICEQUALIZER_HPP
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace spotify_backstage {
+
+// ISO 10-band (octave) or 31-band (third octave) graphic equalizer.
+class GraphicEqualizer
+{
+public:
+    GraphicEqualizer();
+    ~GraphicEqualizer();
+
+    // Center frequencies of the bands. Empty if num_bands isn't 10 or 31.
+    static std::vector<double> getBandFrequencies(int num_bands);
+
+    int getNumBands() const;
+    std::vector<double> getBandGains() const;
+    double getGain() const;
+
+    void equalize(int16_t* audio_data, int num_samples, int num_channels, int sample_rate);
+    void reset();
+    // Set up the filters for the block format, so that equalize() doesn't need to
+    void prepare(int num_channels, int sample_rate);
+    bool setNumBands(int num_bands);
+    void setBandGain(int band, double gain);
+    void setGain(double gain);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+}
+
+#endif
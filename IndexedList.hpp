@@ -0,0 +1,243 @@
+#ifndef SPOTIFY_BACKSTAGE_INDEXEDLIST_HPP
+#define SPOTIFY_BACKSTAGE_INDEXEDLIST_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace spotify_backstage {
+
+// Sequence with O(log n) access, insert and erase by index.
+// Implemented as an implicit treap: a randomized binary tree ordered by position,
+// where each node knows the size of its subtree.
+template<typename T>
+class IndexedList
+{
+public:
+    IndexedList() : root_(), rng_(std::random_device()())
+    {
+    }
+
+    int size() const
+    {
+        return sizeOf(root_);
+    }
+
+    bool empty() const
+    {
+        return !root_;
+    }
+
+    T& at(int index)
+    {
+        auto* node = root_.get();
+        while (true)
+        {
+            const int left = sizeOf(node->left);
+            if (index < left)
+                node = node->left.get();
+            else if (index > left)
+            {
+                index -= left + 1;
+                node = node->right.get();
+            }
+            else
+                return node->value;
+        }
+    }
+
+    T& front()
+    {
+        return at(0);
+    }
+
+    // Insert value so that it will be at index (0 <= index <= size())
+    void insert(int index, T value)
+    {
+        Ptr left, right;
+        split(std::move(root_), index, left, right);
+        root_ = merge(merge(std::move(left), Ptr(new Node(std::move(value), rng_()))), std::move(right));
+    }
+
+    void push_back(T value)
+    {
+        insert(size(), std::move(value));
+    }
+
+    // Remove the value at index and return it
+    T erase(int index)
+    {
+        Ptr left, mid, right;
+        split(std::move(root_), index, left, mid);
+        split(std::move(mid), 1, mid, right);
+        root_ = merge(std::move(left), std::move(right));
+        return std::move(mid->value);
+    }
+
+    // Move the value at from so that it will be at index to
+    void move(int from, int to)
+    {
+        insert(to, erase(from));
+    }
+
+    // Shuffle the values in range [first, last). Takes linear time in the length of the range.
+    void shuffle(int first, int last)
+    {
+        Ptr left, mid, right;
+        split(std::move(root_), last, mid, right);
+        split(std::move(mid), first, left, mid);
+
+        std::vector<T> values;
+        values.reserve(sizeOf(mid));
+        collect(std::move(mid), values);
+        std::shuffle(values.begin(), values.end(), rng_);
+
+        root_ = merge(merge(std::move(left), build(values)), std::move(right));
+    }
+
+    void clear()
+    {
+        root_.reset();
+    }
+
+    // Call f for each value in order
+    template<typename F>
+    void forEach(F f)
+    {
+        forEach(root_.get(), f);
+    }
+
+private:
+    struct Node;
+    typedef std::unique_ptr<Node> Ptr;
+
+    struct Node
+    {
+        Node(T value_p, uint32_t priority_p)
+          : value(std::move(value_p)), priority(priority_p), size(1), left(), right()
+        {
+        }
+
+        void update()
+        {
+            size = 1 + sizeOf(left) + sizeOf(right);
+        }
+
+        T value;
+        uint32_t priority;
+        int size;
+        Ptr left;
+        Ptr right;
+    };
+
+    static int sizeOf(const Ptr& node)
+    {
+        return node ? node->size : 0;
+    }
+
+    // Split tree to the first count values and the rest
+    static void split(Ptr tree, int count, Ptr& first, Ptr& rest)
+    {
+        if (!tree)
+        {
+            first.reset();
+            rest.reset();
+        }
+        else if (sizeOf(tree->left) < count)
+        {
+            split(std::move(tree->right), count - sizeOf(tree->left) - 1, tree->right, rest);
+            tree->update();
+            first = std::move(tree);
+        }
+        else
+        {
+            split(std::move(tree->left), count, first, tree->left);
+            tree->update();
+            rest = std::move(tree);
+        }
+    }
+
+    static Ptr merge(Ptr first, Ptr rest)
+    {
+        if (!first)
+            return rest;
+        if (!rest)
+            return first;
+
+        if (first->priority > rest->priority)
+        {
+            first->right = merge(std::move(first->right), std::move(rest));
+            first->update();
+            return first;
+        }
+
+        rest->left = merge(std::move(first), std::move(rest->left));
+        rest->update();
+        return rest;
+    }
+
+    static void collect(Ptr tree, std::vector<T>& values)
+    {
+        if (!tree)
+            return;
+
+        collect(std::move(tree->left), values);
+        values.push_back(std::move(tree->value));
+        collect(std::move(tree->right), values);
+    }
+
+    // Build tree from values in linear time
+    Ptr build(std::vector<T>& values)
+    {
+        // Right spine of the tree built so far
+        std::vector<Ptr> spine;
+
+        for (auto& value : values)
+        {
+            Ptr node(new Node(std::move(value), rng_()));
+            Ptr last;
+            while (!spine.empty() && spine.back()->priority < node->priority)
+            {
+                spine.back()->right = std::move(last);
+                spine.back()->update();
+                last = std::move(spine.back());
+                spine.pop_back();
+            }
+            node->left = std::move(last);
+            node->update();
+            spine.push_back(std::move(node));
+        }
+
+        Ptr last;
+        while (!spine.empty())
+        {
+            spine.back()->right = std::move(last);
+            spine.back()->update();
+            last = std::move(spine.back());
+            spine.pop_back();
+        }
+
+        return last;
+    }
+
+    template<typename F>
+    static void forEach(Node* node, F& f)
+    {
+        if (!node)
+            return;
+
+        forEach(node->left.get(), f);
+        f(node->value);
+        forEach(node->right.get(), f);
+    }
+
+    Ptr root_;
+    std::mt19937 rng_;
+};
+
+}
+
+#endif
@@ -0,0 +1,588 @@
+#include "NetworkSink.hpp"
+
+#include "AudioAllocations.hpp"
+#include "AudioBlockPool.hpp"
+#include "Logger.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <netinet/in.h>
+#include <sstream>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace spotify_backstage {
+
+namespace {
+// Max number of chunks kept for clients that are behind. Clients falling further behind are dropped.
+const int MAX_CHUNKS = 256;
+// Audio blocks for the chunks: enough for the chunk buffer and the chunks not yet taken by the network thread
+const int NUM_BLOCKS = MAX_CHUNKS + 32;
+// Max number of samples in a chunk. Longer writes are split.
+const int BLOCK_SIZE = 4096;
+// Max number of buffers passed to one sendmsg call
+const int MAX_IOVECS = 64;
+const int MAX_EVENTS = 64;
+const std::size_t MAX_REQUEST_SIZE = 4096;
+}
+
+class NetworkSink::Impl
+{
+public:
+    Impl(int port)
+      : listen_fd_(-1),
+        epoll_fd_(-1),
+        event_fd_(-1),
+        port_(-1),
+        terminate_(false),
+        num_clients_(0),
+        sample_rate_(44100),
+        num_channels_(2),
+        pool_(NUM_BLOCKS, BLOCK_SIZE),
+        incoming_mutex_(),
+        incoming_(),
+        taken_(),
+        chunks_(MAX_CHUNKS),
+        first_seq_(0),
+        next_seq_(0),
+        clients_(),
+        thread_()
+    {
+        incoming_.reserve(NUM_BLOCKS);
+        taken_.reserve(NUM_BLOCKS);
+
+        if (openSockets(port))
+        {
+            LOG("Network sink listening on port " << port_);
+            thread_ = std::thread(&Impl::run, this);
+        }
+        else
+            closeSockets();
+    }
+
+    ~Impl()
+    {
+        if (thread_.joinable())
+        {
+            terminate_ = true;
+            wake();
+            thread_.join();
+        }
+
+        for (const auto& client : clients_)
+            close(client.first);
+
+        closeSockets();
+    }
+
+    bool isOpen() const
+    {
+        return listen_fd_ >= 0;
+    }
+
+    int getPort() const
+    {
+        return port_;
+    }
+
+    int getNumClients() const
+    {
+        return num_clients_;
+    }
+
+    void write(int sample_rate, int num_channels, const int16_t* audio_data, int num_samples)
+    {
+        sample_rate_ = sample_rate;
+        num_channels_ = num_channels;
+
+        // Nobody is listening, don't bother
+        if (num_clients_ == 0 || num_samples == 0)
+            return;
+
+        // Split to whole frames that fit in a block
+        const auto max_samples = pool_.getBlockSize() / num_channels * num_channels;
+        for (int start = 0; start < num_samples; start += max_samples)
+        {
+            auto chunk = makeChunk(sample_rate, num_channels, audio_data + start,
+                std::min(max_samples, num_samples - start));
+
+            std::lock_guard<std::mutex> lock(incoming_mutex_);
+            incoming_.push_back(std::move(chunk));
+        }
+
+        wake();
+    }
+
+private:
+    // Chunk is a block of audio shared by all the clients.
+    // The samples are stored in network byte order, as L16 requires.
+    AudioBlockRef makeChunk(int sample_rate, int num_channels, const int16_t* audio_data, int num_samples)
+    {
+        auto chunk = pool_.acquire(num_samples);
+        chunk->sample_rate = sample_rate;
+        chunk->num_channels = num_channels;
+        chunk->size = num_samples;
+
+        auto* bytes = reinterpret_cast<char*>(chunk->data);
+        for (int i = 0; i < num_samples; ++i)
+        {
+            const auto sample = static_cast<uint16_t>(audio_data[i]);
+            bytes[2 * i] = static_cast<char>(sample >> 8);
+            bytes[2 * i + 1] = static_cast<char>(sample & 0xff);
+        }
+
+        return chunk;
+    }
+
+    static char* bytesOf(const AudioBlockRef& chunk)
+    {
+        return reinterpret_cast<char*>(chunk->data);
+    }
+
+    static std::size_t numBytesOf(const AudioBlockRef& chunk)
+    {
+        return 2 * chunk->size;
+    }
+
+    const AudioBlockRef& chunkAt(uint64_t seq) const
+    {
+        return chunks_[seq % chunks_.size()];
+    }
+
+    struct Client
+    {
+        Client()
+          : request(), header(), header_pos(0), seq(0), pos(0), sample_rate(0), num_channels(0),
+            streaming(false), want_write(false)
+        {
+        }
+
+        // HTTP request received so far
+        std::string request;
+        // HTTP response header and the amount of it sent
+        std::string header;
+        std::size_t header_pos;
+        // Cursor to the shared chunks: next chunk to send and position in it
+        uint64_t seq;
+        std::size_t pos;
+        // Format announced in the header
+        int sample_rate;
+        int num_channels;
+        bool streaming;
+        bool want_write;
+    };
+
+    bool openSockets(int port)
+    {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd_ < 0)
+        {
+            LOG("Couldn't create socket: " << std::strerror(errno));
+            return false;
+        }
+
+        int reuse = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+
+        if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+            listen(listen_fd_, SOMAXCONN) < 0)
+        {
+            LOG("Couldn't listen on port " << port << ": " << std::strerror(errno));
+            return false;
+        }
+
+        socklen_t addr_len = sizeof(addr);
+        getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &addr_len);
+        port_ = ntohs(addr.sin_port);
+
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epoll_fd_ < 0 || event_fd_ < 0)
+        {
+            LOG("Couldn't create epoll/eventfd: " << std::strerror(errno));
+            return false;
+        }
+
+        return addToEpoll(listen_fd_, EPOLLIN) && addToEpoll(event_fd_, EPOLLIN);
+    }
+
+    void closeSockets()
+    {
+        for (auto fd : { event_fd_, epoll_fd_, listen_fd_ })
+            if (fd >= 0)
+                close(fd);
+
+        listen_fd_ = epoll_fd_ = event_fd_ = -1;
+        port_ = -1;
+    }
+
+    bool addToEpoll(int fd, uint32_t events)
+    {
+        epoll_event ev;
+        std::memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.fd = fd;
+        return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) == 0;
+    }
+
+    void wake()
+    {
+        const uint64_t one = 1;
+        if (::write(event_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            LOG("Couldn't wake network sink: " << std::strerror(errno));
+    }
+
+    uint64_t nextSeq() const
+    {
+        return next_seq_;
+    }
+
+    void run()
+    {
+        epoll_event events[MAX_EVENTS];
+
+        while (!terminate_)
+        {
+            const auto num_events = epoll_wait(epoll_fd_, events, MAX_EVENTS, -1);
+            if (num_events < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                LOG("epoll_wait failed: " << std::strerror(errno));
+                break;
+            }
+
+            for (int i = 0; i < num_events; ++i)
+            {
+                const auto fd = events[i].data.fd;
+                if (fd == listen_fd_)
+                    acceptClients();
+                else if (fd == event_fd_)
+                    takeIncoming();
+                else
+                    handleClient(fd, events[i].events);
+            }
+        }
+
+        LOG("Shutting down network sink");
+    }
+
+    void acceptClients()
+    {
+        while (true)
+        {
+            const auto fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                    LOG("accept failed: " << std::strerror(errno));
+                return;
+            }
+
+            if (!addToEpoll(fd, EPOLLIN))
+            {
+                close(fd);
+                continue;
+            }
+
+            LOG("Network client connected: " << fd);
+            clients_[fd] = Client();
+        }
+    }
+
+    // Move the chunks written by the producer to the shared chunk buffer and send them to the clients
+    void takeIncoming()
+    {
+        AudioAllocations::Scope counted;
+
+        uint64_t count = 0;
+        if (read(event_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            LOG("Couldn't read eventfd: " << std::strerror(errno));
+
+        // Swapped with the producer's vector, so that both keep their capacity
+        {
+            std::lock_guard<std::mutex> lock(incoming_mutex_);
+            taken_.swap(incoming_);
+        }
+
+        std::vector<int> dropped;
+        for (auto& chunk : taken_)
+        {
+            for (const auto& client : clients_)
+            {
+                const auto& c = client.second;
+                if (c.streaming && (c.sample_rate != chunk->sample_rate || c.num_channels != chunk->num_channels))
+                {
+                    LOG("Change in stream format, dropping network client " << client.first);
+                    dropped.push_back(client.first);
+                }
+            }
+
+            // When the buffer is full, the oldest chunk is replaced
+            chunks_[next_seq_ % chunks_.size()] = std::move(chunk);
+            ++next_seq_;
+            if (next_seq_ - first_seq_ > chunks_.size())
+                ++first_seq_;
+        }
+        taken_.clear();
+
+        for (const auto& client : clients_)
+        {
+            if (client.second.streaming && client.second.seq < first_seq_)
+            {
+                LOG("Network client " << client.first << " too slow, dropping");
+                dropped.push_back(client.first);
+            }
+        }
+
+        for (auto fd : dropped)
+            dropClient(fd);
+
+        dropped.clear();
+        for (auto& client : clients_)
+            if (client.second.streaming && !client.second.want_write && !flushClient(client.first, client.second))
+                dropped.push_back(client.first);
+
+        for (auto fd : dropped)
+            dropClient(fd);
+    }
+
+    void handleClient(int fd, uint32_t events)
+    {
+        auto it = clients_.find(fd);
+        if (it == clients_.end())
+            return;
+
+        auto ok = (events & (EPOLLERR | EPOLLHUP)) == 0;
+
+        if (ok && (events & EPOLLIN))
+            ok = readRequest(fd, it->second);
+
+        if (ok && (events & EPOLLOUT))
+            ok = flushClient(fd, it->second);
+
+        if (!ok)
+            dropClient(fd);
+    }
+
+    // Read (and discard) the HTTP request. Start streaming once the request is complete.
+    bool readRequest(int fd, Client& c)
+    {
+        char buf[1024];
+        while (true)
+        {
+            const auto n = read(fd, buf, sizeof(buf));
+            if (n == 0)
+                return false;
+
+            if (n < 0)
+                return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+            if (c.streaming)
+                continue;
+
+            c.request.append(buf, n);
+            if (c.request.find("\r\n\r\n") != std::string::npos)
+            {
+                startStreaming(c);
+                return flushClient(fd, c);
+            }
+
+            if (c.request.size() > MAX_REQUEST_SIZE)
+                return false;
+        }
+    }
+
+    void startStreaming(Client& c)
+    {
+        c.sample_rate = sample_rate_;
+        c.num_channels = num_channels_;
+
+        std::stringstream header;
+        header << "HTTP/1.0 200 OK\r\n"
+               << "Content-Type: audio/L16;rate=" << c.sample_rate << ";channels=" << c.num_channels << "\r\n"
+               << "Cache-Control: no-cache\r\n"
+               << "Connection: close\r\n\r\n";
+
+        c.request.clear();
+        c.header = header.str();
+        c.header_pos = 0;
+
+        // New clients join at the live edge
+        c.seq = nextSeq();
+        c.pos = 0;
+        c.streaming = true;
+        ++num_clients_;
+    }
+
+    // Send as much of the pending data as the socket takes. One sendmsg covers many chunks.
+    bool flushClient(int fd, Client& c)
+    {
+        while (true)
+        {
+            iovec iov[MAX_IOVECS];
+            int num_iov = 0;
+
+            if (c.header_pos < c.header.size())
+            {
+                iov[num_iov].iov_base = &c.header[c.header_pos];
+                iov[num_iov].iov_len = c.header.size() - c.header_pos;
+                ++num_iov;
+            }
+
+            auto pos = c.pos;
+            for (auto seq = c.seq; num_iov < MAX_IOVECS && seq < nextSeq(); ++seq, pos = 0)
+            {
+                const auto& chunk = chunkAt(seq);
+                iov[num_iov].iov_base = bytesOf(chunk) + pos;
+                iov[num_iov].iov_len = numBytesOf(chunk) - pos;
+                ++num_iov;
+            }
+
+            if (num_iov == 0)
+                return setWantWrite(fd, c, false);
+
+            msghdr msg;
+            std::memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = num_iov;
+
+            const auto sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+            if (sent < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return setWantWrite(fd, c, true);
+
+                return false;
+            }
+
+            advance(c, sent);
+        }
+    }
+
+    void advance(Client& c, std::size_t num_bytes)
+    {
+        const auto from_header = std::min(num_bytes, c.header.size() - c.header_pos);
+        c.header_pos += from_header;
+        num_bytes -= from_header;
+
+        while (num_bytes > 0)
+        {
+            const auto chunk_size = numBytesOf(chunkAt(c.seq));
+            const auto from_chunk = std::min(num_bytes, chunk_size - c.pos);
+            c.pos += from_chunk;
+            num_bytes -= from_chunk;
+
+            if (c.pos == chunk_size)
+            {
+                ++c.seq;
+                c.pos = 0;
+            }
+        }
+    }
+
+    // Listen to EPOLLOUT only while the client has data that didn't fit in the socket
+    bool setWantWrite(int fd, Client& c, bool want_write)
+    {
+        if (c.want_write == want_write)
+            return true;
+
+        epoll_event ev;
+        std::memset(&ev, 0, sizeof(ev));
+        ev.events = want_write ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        ev.data.fd = fd;
+        c.want_write = want_write;
+        return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev) == 0;
+    }
+
+    void dropClient(int fd)
+    {
+        auto it = clients_.find(fd);
+        if (it == clients_.end())
+            return;
+
+        LOG("Network client disconnected: " << fd);
+
+        if (it->second.streaming)
+            --num_clients_;
+
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        clients_.erase(it);
+    }
+
+    int listen_fd_;
+    int epoll_fd_;
+    int event_fd_;
+    int port_;
+    std::atomic<bool> terminate_;
+    std::atomic<int> num_clients_;
+    // Format of the latest write, used in the header sent to new clients
+    std::atomic<int> sample_rate_;
+    std::atomic<int> num_channels_;
+    // Declared before the chunks, as it must outlive them
+    AudioBlockPool pool_;
+    // Chunks written, but not yet taken by the network thread
+    std::mutex incoming_mutex_;
+    std::vector<AudioBlockRef> incoming_;
+    // Chunks being taken by the network thread
+    std::vector<AudioBlockRef> taken_;
+    // Shared chunk buffer, owned by the network thread, used as a ring.
+    // Holds the chunks from sequence number first_seq_ to next_seq_.
+    std::vector<AudioBlockRef> chunks_;
+    uint64_t first_seq_;
+    uint64_t next_seq_;
+    std::map<int, Client> clients_;
+    std::thread thread_;
+};
+
+NetworkSink::NetworkSink(int port)
+  : impl_(new Impl(port))
+{
+}
+
+NetworkSink::~NetworkSink()
+{
+}
+
+bool NetworkSink::isOpen() const
+{
+    return impl_->isOpen();
+}
+
+int NetworkSink::getPort() const
+{
+    return impl_->getPort();
+}
+
+int NetworkSink::getNumClients() const
+{
+    return impl_->getNumClients();
+}
+
+void NetworkSink::write(int sample_rate, int num_channels, const int16_t* audio_data, int num_samples)
+{
+    impl_->write(sample_rate, num_channels, audio_data, num_samples);
+}
+
+}
@@ -0,0 +1,32 @@
+#ifndef SPOTIFY_BACKSTAGE_NETWORKSINK_HPP
+#define SPOTIFY_BACKSTAGE_NETWORKSINK_HPP
+
+#include <cstdint>
+#include <memory>
+
+namespace spotify_backstage {
+
+// Serves the audio stream to any number of TCP clients as HTTP audio/L16.
+// All clients share the same reference-counted chunks, each client only has a cursor to them.
+// The chunks are pooled audio blocks, so streaming doesn't allocate.
+class NetworkSink
+{
+public:
+    // Open listening socket on port (0 = let the system pick one)
+    explicit NetworkSink(int port);
+    ~NetworkSink();
+
+    bool isOpen() const;
+    int getPort() const;
+    int getNumClients() const;
+
+    void write(int sample_rate, int num_channels, const int16_t* audio_data, int num_samples);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+}
+
+#endif
@@ -0,0 +1,383 @@
+#include "OutputEqualizer.hpp"
+
+#include "Equalizer.hpp"
+#include "GraphicEqualizer.hpp"
+#include <boost/lockfree/spsc_queue.hpp>
+#include <algorithm>
+#include <atomic>
+
+namespace spotify_backstage {
+
+namespace {
+// Most bands the graphic equalizer has
+const int MAX_BANDS = 31;
+}
+
+class OutputEqualizer::Impl
+{
+public:
+    Impl()
+      : on_(false), low_latency_(0), gain_(), bass_(), mid_(), treble_(), num_bands_(0), band_gains_(), version_(0),
+        num_channels_(2), sample_rate_(44100), pending_(nullptr), retired_(), current_(nullptr), applied_version_(0)
+    {
+        Equalizer eq;
+        gain_ = eq.getGain();
+        bass_ = eq.getBass();
+        mid_ = eq.getMid();
+        treble_ = eq.getTreble();
+        for (auto& band_gain : band_gains_)
+            band_gain = 1.0;
+
+        current_ = build();
+    }
+
+    Impl(const Impl&) = delete;
+    Impl& operator=(const Impl&) = delete;
+
+    ~Impl()
+    {
+        releaseRetired();
+        delete pending_.exchange(nullptr);
+        delete current_;
+    }
+
+    // The setters store the latest value and bump the version. The audio driver thread picks up the latest values
+    // at the start of the next block, so any number of changes between the blocks fit.
+
+    void setOn(bool on)
+    {
+        on_ = on;
+        ++version_;
+    }
+
+    void setLowLatency(bool on, long long from_position)
+    {
+        // Position and mode in one value, so that the driver thread never sees a mix of two switches
+        low_latency_ = from_position * 2 + (on ? 1 : 0);
+    }
+
+    void setGain(double gain)
+    {
+        gain_ = gain;
+        ++version_;
+    }
+
+    void setBass(double bass)
+    {
+        bass_ = bass;
+        ++version_;
+    }
+
+    void setMid(double mid)
+    {
+        mid_ = mid;
+        ++version_;
+    }
+
+    void setTreble(double treble)
+    {
+        treble_ = treble;
+        ++version_;
+    }
+
+    // Changing the band count or the format recomputes and reallocates the filters, so they are built here
+    // and handed over to the driver thread
+
+    void setNumBands(int num_bands)
+    {
+        // Setting the number of bands resets the band gains
+        num_bands_ = num_bands;
+        for (auto& band_gain : band_gains_)
+            band_gain = 1.0;
+        publish(build());
+    }
+
+    void setFormat(int num_channels, int sample_rate)
+    {
+        num_channels_ = num_channels;
+        sample_rate_ = sample_rate;
+        publish(build());
+    }
+
+    void setBandGain(int band, double gain)
+    {
+        if (band < 0 || band >= MAX_BANDS)
+            return;
+
+        band_gains_[band] = gain;
+        ++version_;
+    }
+
+    void process(int16_t* audio_data, int num_samples, int num_channels, int sample_rate, long long position)
+    {
+        // The previous filters can only be handed back if there's room for them
+        bool changed = false;
+        if (retired_.write_available() > 0)
+        {
+            auto* filters = pending_.exchange(nullptr);
+            if (filters)
+            {
+                retired_.push(current_);
+                current_ = filters;
+                changed = true;
+            }
+        }
+
+        // A change made while the values are read bumps the version again, and is picked up on the next block
+        const unsigned version = version_;
+        if (version != applied_version_ || changed)
+        {
+            applied_version_ = version;
+            applyParams();
+        }
+
+        // The filters are set up for the stream format. Anything else is let through as it is.
+        if (!on_ || num_channels != current_->num_channels || sample_rate != current_->sample_rate)
+            return;
+
+        // The mode applies from the switch position on, the samples before it are in the previous mode
+        const long long low_latency = low_latency_;
+        const long long switch_position = low_latency / 2;
+        const bool on_after_switch = low_latency % 2 != 0;
+
+        if (switch_position <= position)
+        {
+            if (on_after_switch)
+                equalize(audio_data, num_samples);
+        }
+        else if (switch_position >= position + num_samples)
+        {
+            if (!on_after_switch)
+                equalize(audio_data, num_samples);
+        }
+        else
+        {
+            const int num_before = static_cast<int>(switch_position - position);
+            if (on_after_switch)
+                equalize(audio_data + num_before, num_samples - num_before);
+            else
+                equalize(audio_data, num_before);
+        }
+    }
+
+private:
+    // Values applied to the filters
+    struct Params
+    {
+        Params() : gain(1.0), bass(1.0), mid(1.0), treble(1.0), num_bands(0), band_gains()
+        {
+        }
+        double gain;
+        double bass;
+        double mid;
+        double treble;
+        int num_bands;
+        double band_gains[MAX_BANDS];
+    };
+
+    // Equalizers set up for one band count and format
+    struct Filters
+    {
+        Filters(int num_channels_p, int sample_rate_p)
+          : eq(), geq(), graphic(false), num_channels(num_channels_p), sample_rate(sample_rate_p), params()
+        {
+        }
+        Equalizer eq;
+        GraphicEqualizer geq;
+        bool graphic;
+        int num_channels;
+        int sample_rate;
+        Params params;
+    };
+
+    void equalize(int16_t* audio_data, int num_samples)
+    {
+        if (current_->graphic)
+            current_->geq.equalize(audio_data, num_samples, current_->num_channels, current_->sample_rate);
+        else
+            current_->eq.equalize(audio_data, num_samples, current_->num_channels);
+    }
+
+    // Called in the setter thread
+    Filters* build()
+    {
+        std::unique_ptr<Filters> filters(new Filters(num_channels_, sample_rate_));
+        auto& params = filters->params;
+
+        // Never wait for other threads in the audio driver thread
+        filters->eq.setMaxThreads(1);
+        filters->eq.prepare(num_channels_);
+
+        params.num_bands = num_bands_;
+        filters->graphic = params.num_bands != 0 && filters->geq.setNumBands(params.num_bands);
+        filters->geq.prepare(num_channels_, sample_rate_);
+
+        params.gain = gain_;
+        params.bass = bass_;
+        params.mid = mid_;
+        params.treble = treble_;
+        filters->eq.setGain(params.gain);
+        filters->eq.setBass(params.bass);
+        filters->eq.setMid(params.mid);
+        filters->eq.setTreble(params.treble);
+        filters->geq.setGain(params.gain);
+
+        std::fill(params.band_gains, params.band_gains + MAX_BANDS, 1.0);
+        for (int band = 0; band < std::min(params.num_bands, MAX_BANDS); ++band)
+        {
+            params.band_gains[band] = band_gains_[band];
+            filters->geq.setBandGain(band, params.band_gains[band]);
+        }
+
+        return filters.release();
+    }
+
+    // Called in the setter thread. Filters the driver thread hasn't picked up yet are replaced.
+    void publish(Filters* filters)
+    {
+        releaseRetired();
+        delete pending_.exchange(filters);
+    }
+
+    // Filters replaced in the driver thread are deleted in the setter thread
+    void releaseRetired()
+    {
+        Filters* filters = nullptr;
+        while (retired_.pop(filters))
+            delete filters;
+    }
+
+    // Only the changed values are applied. None of these allocate.
+    void applyParams()
+    {
+        auto& filters = *current_;
+        auto& applied = filters.params;
+
+        const double gain = gain_;
+        if (gain != applied.gain)
+        {
+            filters.eq.setGain(gain);
+            filters.geq.setGain(gain);
+            applied.gain = gain;
+        }
+
+        const double bass = bass_;
+        if (bass != applied.bass)
+        {
+            filters.eq.setBass(bass);
+            applied.bass = bass;
+        }
+
+        const double mid = mid_;
+        if (mid != applied.mid)
+        {
+            filters.eq.setMid(mid);
+            applied.mid = mid;
+        }
+
+        const double treble = treble_;
+        if (treble != applied.treble)
+        {
+            filters.eq.setTreble(treble);
+            applied.treble = treble;
+        }
+
+        for (int band = 0; band < std::min(applied.num_bands, MAX_BANDS); ++band)
+        {
+            const double band_gain = band_gains_[band];
+            if (band_gain != applied.band_gains[band])
+            {
+                filters.geq.setBandGain(band, band_gain);
+                applied.band_gains[band] = band_gain;
+            }
+        }
+    }
+
+    // Latest values set, written by the setter thread
+    std::atomic<bool> on_;
+    // Switch position * 2 + low latency mode after it
+    std::atomic<long long> low_latency_;
+    std::atomic<double> gain_;
+    std::atomic<double> bass_;
+    std::atomic<double> mid_;
+    std::atomic<double> treble_;
+    std::atomic<int> num_bands_;
+    std::atomic<double> band_gains_[MAX_BANDS];
+    // Incremented after every change
+    std::atomic<unsigned> version_;
+
+    // Used only in the setter thread
+    int num_channels_;
+    int sample_rate_;
+
+    // Filters built by the setter thread, waiting to be picked up by the driver thread
+    std::atomic<Filters*> pending_;
+    // Filters replaced by the driver thread. Between two publish() calls, the driver thread can replace at most
+    // the filters pending at the first call and those published by the second.
+    boost::lockfree::spsc_queue<Filters*, boost::lockfree::capacity<4>> retired_;
+
+    // Used only in the audio driver thread
+    Filters* current_;
+    unsigned applied_version_;
+};
+
+OutputEqualizer::OutputEqualizer()
+  : impl_(new Impl)
+{
+}
+
+OutputEqualizer::~OutputEqualizer()
+{
+}
+
+void OutputEqualizer::setOn(bool on)
+{
+    impl_->setOn(on);
+}
+
+void OutputEqualizer::setLowLatency(bool on, long long from_position)
+{
+    impl_->setLowLatency(on, from_position);
+}
+
+void OutputEqualizer::setGain(double gain)
+{
+    impl_->setGain(gain);
+}
+
+void OutputEqualizer::setBass(double bass)
+{
+    impl_->setBass(bass);
+}
+
+void OutputEqualizer::setMid(double mid)
+{
+    impl_->setMid(mid);
+}
+
+void OutputEqualizer::setTreble(double treble)
+{
+    impl_->setTreble(treble);
+}
+
+void OutputEqualizer::setNumBands(int num_bands)
+{
+    impl_->setNumBands(num_bands);
+}
+
+void OutputEqualizer::setBandGain(int band, double gain)
+{
+    impl_->setBandGain(band, gain);
+}
+
+void OutputEqualizer::setFormat(int num_channels, int sample_rate)
+{
+    impl_->setFormat(num_channels, sample_rate);
+}
+
+void OutputEqualizer::process(int16_t* audio_data, int num_samples, int num_channels, int sample_rate, long long position)
+{
+    impl_->process(audio_data, num_samples, num_channels, sample_rate, position);
+}
+
+}
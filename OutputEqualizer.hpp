@@ -0,0 +1,45 @@
+#ifndef SPOTIFY_BACKSTAGE_OUTPUTEQUALIZER_HPP
+#define SPOTIFY_BACKSTAGE_OUTPUTEQUALIZER_HPP
+
+#include <cstdint>
+#include <memory>
+
+namespace spotify_backstage {
+
+// Equalizer run in the audio driver thread, on the blocks going to the device.
+// The setters can be called from one other thread. The gains are only stored in atomics, so they never block or
+// overflow, and the driver thread applies the latest values at the start of the next block. A band count or format
+// change builds new filters in the setter thread, and the driver thread swaps them in. The driver thread doesn't
+// allocate or log.
+class OutputEqualizer
+{
+public:
+    OutputEqualizer();
+    ~OutputEqualizer();
+
+    void setOn(bool on);
+    // Equalize the samples from the given buffer read position on (low latency mode), or stop doing it.
+    // The samples before the position were written in the previous mode, and are played as they were processed.
+    // A new switch must not be made before the previous switch position has been played.
+    void setLowLatency(bool on, long long from_position);
+    void setGain(double gain);
+    void setBass(double bass);
+    void setMid(double mid);
+    void setTreble(double treble);
+    // 10 or 31 = use graphic equalizer with that many bands, 0 = use the three band equalizer
+    void setNumBands(int num_bands);
+    void setBandGain(int band, double gain);
+    // Format of the blocks going to the device. Blocks in other formats aren't equalized.
+    void setFormat(int num_channels, int sample_rate);
+
+    // Called from the audio driver thread. position = buffer read position of the first sample.
+    void process(int16_t* audio_data, int num_samples, int num_channels, int sample_rate, long long position);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+}
+
+#endif
@@ -0,0 +1,224 @@
+#include "PlaybackState.hpp"
+
+#include "Logger.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+
+namespace spotify_backstage {
+
+namespace {
+
+const char MAGIC[] = { 'S', 'B', 'P', 'S' };
+const uint32_t VERSION = 1;
+
+// Bits of the flags field
+const uint32_t FLAG_PLAYING = 1 << 0;
+const uint32_t FLAG_PAUSED = 1 << 1;
+const uint32_t FLAG_EQ_ON = 1 << 2;
+const uint32_t FLAG_LOW_LATENCY = 1 << 3;
+
+// The numbers are stored in little endian, the doubles as their bit patterns
+
+void putLe(std::vector<char>& buf, uint64_t val, int num_bytes)
+{
+    for (int i = 0; i < num_bytes; ++i)
+        buf.push_back(static_cast<char>((val >> (8 * i)) & 0xff));
+}
+
+void putDouble(std::vector<char>& buf, double val)
+{
+    uint64_t bits = 0;
+    std::memcpy(&bits, &val, sizeof(bits));
+    putLe(buf, bits, 8);
+}
+
+// Reads the fields in order. Once a read goes past the end, ok() is false and the reads return 0.
+class Reader
+{
+public:
+    explicit Reader(const std::vector<char>& buf) : buf_(buf), pos_(0), ok_(true)
+    {
+    }
+
+    bool ok() const
+    {
+        return ok_;
+    }
+
+    bool atEnd() const
+    {
+        return pos_ == buf_.size();
+    }
+
+    uint64_t getLe(int num_bytes)
+    {
+        if (!has(num_bytes))
+            return 0;
+
+        uint64_t val = 0;
+        for (int i = 0; i < num_bytes; ++i)
+            val |= static_cast<uint64_t>(static_cast<unsigned char>(buf_[pos_ + i])) << (8 * i);
+
+        pos_ += num_bytes;
+        return val;
+    }
+
+    double getDouble()
+    {
+        const auto bits = getLe(8);
+        double val = 0.0;
+        std::memcpy(&val, &bits, sizeof(val));
+        return val;
+    }
+
+    std::string getString(std::size_t size)
+    {
+        if (!has(size))
+            return std::string();
+
+        std::string str(&buf_[pos_], size);
+        pos_ += size;
+        return str;
+    }
+
+private:
+    bool has(std::size_t size)
+    {
+        ok_ = ok_ && buf_.size() - pos_ >= size;
+        return ok_;
+    }
+
+    const std::vector<char>& buf_;
+    std::size_t pos_;
+    bool ok_;
+};
+
+}
+
+std::vector<char> encodePlaybackState(const PlaybackState& state)
+{
+    std::vector<char> buf(MAGIC, MAGIC + sizeof(MAGIC));
+    putLe(buf, VERSION, 4);
+
+    const uint32_t flags = (state.playing ? FLAG_PLAYING : 0) | (state.paused ? FLAG_PAUSED : 0) |
+        (state.eq_state.is_on ? FLAG_EQ_ON : 0) | (state.eq_state.low_latency ? FLAG_LOW_LATENCY : 0);
+    putLe(buf, flags, 4);
+    putLe(buf, static_cast<uint32_t>(state.position_ms), 4);
+
+    putDouble(buf, state.eq_state.gain);
+    putDouble(buf, state.eq_state.bass);
+    putDouble(buf, state.eq_state.mid);
+    putDouble(buf, state.eq_state.treble);
+    putLe(buf, state.eq_state.bands.size(), 4);
+    for (auto band : state.eq_state.bands)
+        putDouble(buf, band);
+
+    putLe(buf, state.uris.size(), 4);
+    for (const auto& uri : state.uris)
+    {
+        putLe(buf, uri.size(), 2);
+        buf.insert(buf.end(), uri.begin(), uri.end());
+    }
+
+    return buf;
+}
+
+bool writePlaybackState(const std::string& path, const std::vector<char>& data, bool sync)
+{
+    const auto tmp_path = path + ".tmp";
+
+    const int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        LOG("Couldn't open " << tmp_path << ": " << std::strerror(errno));
+        return false;
+    }
+
+    std::size_t written = 0;
+    while (written < data.size())
+    {
+        const auto n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            break;
+        written += n;
+    }
+
+    // Synced before the rename, so the rename never points path to data that isn't on disk yet
+    const bool ok = written == data.size() && (!sync || ::fsync(fd) == 0);
+    ::close(fd);
+
+    if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        LOG("Couldn't write " << path << ": " << std::strerror(errno));
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool readPlaybackState(const std::string& path, PlaybackState& state)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file)
+        return false;
+
+    const std::vector<char> buf((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (buf.size() < sizeof(MAGIC) || std::memcmp(buf.data(), MAGIC, sizeof(MAGIC)) != 0)
+    {
+        LOG("Not a state file: " << path);
+        return false;
+    }
+
+    Reader reader(buf);
+    reader.getString(sizeof(MAGIC));
+    if (reader.getLe(4) != VERSION)
+    {
+        LOG("Unsupported state file version: " << path);
+        return false;
+    }
+
+    PlaybackState read;
+    const auto flags = reader.getLe(4);
+    read.playing = flags & FLAG_PLAYING;
+    read.paused = flags & FLAG_PAUSED;
+    read.eq_state.is_on = flags & FLAG_EQ_ON;
+    read.eq_state.low_latency = flags & FLAG_LOW_LATENCY;
+    read.position_ms = static_cast<int32_t>(reader.getLe(4));
+
+    read.eq_state.gain = reader.getDouble();
+    read.eq_state.bass = reader.getDouble();
+    read.eq_state.mid = reader.getDouble();
+    read.eq_state.treble = reader.getDouble();
+
+    // The counts are checked against the reads, so a corrupt count doesn't allocate more than the file size
+    const auto num_bands = reader.getLe(4);
+    for (uint64_t i = 0; i < num_bands && reader.ok(); ++i)
+        read.eq_state.bands.push_back(reader.getDouble());
+
+    const auto num_uris = reader.getLe(4);
+    for (uint64_t i = 0; i < num_uris && reader.ok(); ++i)
+    {
+        const auto size = reader.getLe(2);
+        read.uris.push_back(reader.getString(size));
+    }
+
+    if (!reader.ok() || !reader.atEnd())
+    {
+        LOG("Corrupt state file: " << path);
+        return false;
+    }
+
+    state = read;
+    return true;
+}
+
+}
@@ -0,0 +1,37 @@
+#ifndef SPOTIFY_BACKSTAGE_PLAYBACKSTATE_HPP
+#define SPOTIFY_BACKSTAGE_PLAYBACKSTATE_HPP
+
+#include "SpotifyBackstage.hpp"
+#include <string>
+#include <vector>
+
+namespace spotify_backstage {
+
+// Playback state kept across restarts
+struct PlaybackState
+{
+    PlaybackState() : uris(), playing(false), paused(false), position_ms(0), eq_state(false, 1.0, 1.0, 1.0, 1.0) {}
+
+    // URIs of the tracks in the play queue. The track at the head is the current track.
+    std::vector<std::string> uris;
+    bool playing;
+    bool paused;
+    // Position in the current track
+    int position_ms;
+    EqState eq_state;
+};
+
+// Encode state in the binary format of the state file
+std::vector<char> encodePlaybackState(const PlaybackState& state);
+
+// Write an encoded state to path. The data is written to a temporary file next to path, which is then renamed over
+// path, so a crash leaves either the old or the new state behind, never a partial one. With sync, the data is synced
+// to the disk before the rename. Without, the new state may be lost if the system crashes soon after the write.
+bool writePlaybackState(const std::string& path, const std::vector<char>& data, bool sync);
+
+// Read a state file. Returns false if there's no file, or it's not a valid state file.
+bool readPlaybackState(const std::string& path, PlaybackState& state);
+
+}
+
+#endif
@@ -0,0 +1,42 @@
+#include "ProcessorChain.hpp"
+
+namespace spotify_backstage {
+
+ProcessorChain::ProcessorChain()
+  : processors_()
+{
+}
+
+ProcessorChain::~ProcessorChain()
+{
+}
+
+int ProcessorChain::size() const
+{
+    return processors_.size();
+}
+
+void ProcessorChain::add(std::shared_ptr<AudioProcessor> processor)
+{
+    processors_.push_back(std::move(processor));
+}
+
+void ProcessorChain::erase(int first)
+{
+    if (first < size())
+        processors_.erase(processors_.begin() + first, processors_.end());
+}
+
+void ProcessorChain::process(int16_t* data, int num_samples, int num_channels, int sample_rate)
+{
+    for (const auto& processor : processors_)
+        processor->process(data, num_samples, num_channels, sample_rate);
+}
+
+void ProcessorChain::reset()
+{
+    for (const auto& processor : processors_)
+        processor->reset();
+}
+
+}
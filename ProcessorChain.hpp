@@ -0,0 +1,123 @@
+#ifndef SPOTIFY_BACKSTAGE_PROCESSORCHAIN_HPP
+#define SPOTIFY_BACKSTAGE_PROCESSORCHAIN_HPP
+
+#include "SpotifyBackstage.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace spotify_backstage {
+
+// Processors run one after another on each block. The processors can be added and removed between the blocks,
+// and each costs one virtual call per block.
+class ProcessorChain
+{
+public:
+    ProcessorChain();
+    ~ProcessorChain();
+
+    int size() const;
+    void add(std::shared_ptr<AudioProcessor> processor);
+    // Remove the processors from index first to the end
+    void erase(int first);
+
+    void process(int16_t* data, int num_samples, int num_channels, int sample_rate);
+    void reset();
+
+private:
+    std::vector<std::shared_ptr<AudioProcessor>> processors_;
+};
+
+// Chain of sample stages fixed at compile time. The stages are run in one pass over the block: each sample is
+// converted to float once, goes through all the stages, and is converted back, and the compiler can inline the
+// stages into one loop. As a whole the chain is an AudioProcessor, so it can be put in a ProcessorChain.
+//
+// A stage is a class with
+//   void prepare(int num_channels, int sample_rate): called before each block
+//   float process(float sample, int channel): process one sample, scaled to [-1.0, 1.0]
+//   void reset(): clear the state kept between the blocks
+template<typename... Stages>
+class SampleChain : public AudioProcessor
+{
+public:
+    SampleChain() : stages_()
+    {
+    }
+
+    // Get stage I, e.g. to change its parameters
+    template<std::size_t I>
+    typename std::tuple_element<I, std::tuple<Stages...>>::type& stage()
+    {
+        return std::get<I>(stages_);
+    }
+
+    void process(int16_t* data, int num_samples, int num_channels, int sample_rate) override
+    {
+        prepare<0>(num_channels, sample_rate);
+
+        for (int i = 0; i < num_samples; i += num_channels)
+        {
+            for (int ch = 0; ch < num_channels; ++ch)
+            {
+                const auto sample = apply<0>(data[i + ch] * (1.0f / 32768.0f), ch);
+                data[i + ch] = static_cast<int16_t>(std::max(-32768.0f, std::min(32767.0f, sample * 32768.0f)));
+            }
+        }
+    }
+
+    void reset() override
+    {
+        resetStages<0>();
+    }
+
+private:
+    static const std::size_t NUM_STAGES = sizeof...(Stages);
+
+    // The recursion over the stages is resolved at compile time
+
+    template<std::size_t I>
+    typename std::enable_if<I == NUM_STAGES>::type prepare(int, int)
+    {
+    }
+
+    template<std::size_t I>
+    typename std::enable_if<I < NUM_STAGES>::type prepare(int num_channels, int sample_rate)
+    {
+        std::get<I>(stages_).prepare(num_channels, sample_rate);
+        prepare<I + 1>(num_channels, sample_rate);
+    }
+
+    template<std::size_t I>
+    typename std::enable_if<I == NUM_STAGES, float>::type apply(float sample, int)
+    {
+        return sample;
+    }
+
+    template<std::size_t I>
+    typename std::enable_if<I < NUM_STAGES, float>::type apply(float sample, int channel)
+    {
+        return apply<I + 1>(std::get<I>(stages_).process(sample, channel), channel);
+    }
+
+    template<std::size_t I>
+    typename std::enable_if<I == NUM_STAGES>::type resetStages()
+    {
+    }
+
+    template<std::size_t I>
+    typename std::enable_if<I < NUM_STAGES>::type resetStages()
+    {
+        std::get<I>(stages_).reset();
+        resetStages<I + 1>();
+    }
+
+    std::tuple<Stages...> stages_;
+};
+
+}
+
+#endif
@@ -0,0 +1,68 @@
+#include "RenderWriter.hpp"
+
+#include "Logger.hpp"
+
+namespace spotify_backstage {
+
+RenderWriter::RenderWriter(const std::string& path, const EqState& eq_state)
+  : path_(path), writer_(), eq_(), geq_(), eq_on_(eq_state.is_on), graphic_eq_(!eq_state.bands.empty()), buffer_()
+{
+    eq_.setGain(eq_state.gain);
+    eq_.setBass(eq_state.bass);
+    eq_.setMid(eq_state.mid);
+    eq_.setTreble(eq_state.treble);
+
+    if (graphic_eq_)
+    {
+        geq_.setNumBands(eq_state.bands.size());
+        geq_.setGain(eq_state.gain);
+        for (int i = 0; i < static_cast<int>(eq_state.bands.size()); ++i)
+            geq_.setBandGain(i, eq_state.bands[i]);
+    }
+}
+
+const std::string& RenderWriter::getPath() const
+{
+    return path_;
+}
+
+bool RenderWriter::isOpen() const
+{
+    return writer_.isOpen();
+}
+
+bool RenderWriter::write(int sample_rate, int num_channels, const int16_t* data, int num_frames)
+{
+    if (!writer_.isOpen())
+    {
+        if (!writer_.open(path_, sample_rate, num_channels))
+            return false;
+    }
+    else if (sample_rate != writer_.getSampleRate() || num_channels != writer_.getNumChannels())
+    {
+        LOG("Change in sample rate / number of channels while rendering");
+        return false;
+    }
+
+    buffer_.assign(data, data + num_channels * num_frames);
+
+    if (eq_on_ && graphic_eq_)
+        geq_.equalize(buffer_.data(), buffer_.size(), num_channels, sample_rate);
+    else if (eq_on_)
+        eq_.equalize(buffer_, num_channels);
+
+    if (!writer_.write(buffer_.data(), buffer_.size()))
+    {
+        LOG("Couldn't write to " << path_);
+        return false;
+    }
+
+    return true;
+}
+
+bool RenderWriter::close()
+{
+    return writer_.close();
+}
+
+}
@@ -0,0 +1,42 @@
+#ifndef SPOTIFY_BACKSTAGE_RENDERWRITER_HPP
+#define SPOTIFY_BACKSTAGE_RENDERWRITER_HPP
+
+#include "Equalizer.hpp"
+#include "GraphicEqualizer.hpp"
+#include "SpotifyBackstage.hpp"
+#include "WavFile.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace spotify_backstage {
+
+// Writes the audio of a render to a WAV file, equalized with the settings the render started with.
+// The file is opened in the format of the first write. Doesn't depend on libspotify, the session
+// only passes it the delivered audio.
+class RenderWriter
+{
+public:
+    RenderWriter(const std::string& path, const EqState& eq_state);
+
+    const std::string& getPath() const;
+    bool isOpen() const;
+
+    // Returns false if the file couldn't be opened or written, or the format isn't the one of the first write
+    bool write(int sample_rate, int num_channels, const int16_t* data, int num_frames);
+    bool close();
+
+private:
+    std::string path_;
+    WavWriter writer_;
+    Equalizer eq_;
+    GraphicEqualizer geq_;
+    bool eq_on_;
+    bool graphic_eq_;
+    // The delivered audio is equalized here, as it can't be modified in place
+    std::vector<int16_t> buffer_;
+};
+
+}
+
+#endif
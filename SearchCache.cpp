@@ -0,0 +1,55 @@
+#include "SearchCache.hpp"
+
+namespace spotify_backstage {
+
+SearchCache::SearchCache(int capacity, std::chrono::steady_clock::duration ttl)
+  : capacity_(capacity), ttl_(ttl), entries_(), index_()
+{
+}
+
+bool SearchCache::get(const Key& key, std::vector<TrackInfo>& tracks)
+{
+    auto it = index_.find(key);
+    if (it == index_.end())
+        return false;
+
+    if (it->second->expires <= std::chrono::steady_clock::now())
+    {
+        erase(it);
+        return false;
+    }
+
+    entries_.splice(entries_.begin(), entries_, it->second);
+    tracks = it->second->tracks;
+    return true;
+}
+
+void SearchCache::put(const Key& key, const std::vector<TrackInfo>& tracks)
+{
+    if (capacity_ < 1)
+        return;
+
+    auto it = index_.find(key);
+    if (it != index_.end())
+        erase(it);
+
+    entries_.emplace_front(key, tracks, std::chrono::steady_clock::now() + ttl_);
+    index_[key] = entries_.begin();
+
+    if (static_cast<int>(entries_.size()) > capacity_)
+        erase(index_.find(entries_.back().key));
+}
+
+void SearchCache::clear()
+{
+    index_.clear();
+    entries_.clear();
+}
+
+void SearchCache::erase(std::map<Key, std::list<Entry>::iterator>::iterator it)
+{
+    entries_.erase(it->second);
+    index_.erase(it);
+}
+
+}
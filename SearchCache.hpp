@@ -0,0 +1,55 @@
+#ifndef SPOTIFY_BACKSTAGE_SEARCHCACHE_HPP
+#define SPOTIFY_BACKSTAGE_SEARCHCACHE_HPP
+
+#include "StringTable.hpp"
+#include <chrono>
+#include <list>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace spotify_backstage {
+
+// Bounded LRU cache of search results. The entries expire after time to live.
+// Not thread safe, used only in the Spotify session thread.
+class SearchCache
+{
+public:
+    // query, num_results, offset
+    typedef std::tuple<std::string, int, int> Key;
+
+    SearchCache(int capacity, std::chrono::steady_clock::duration ttl);
+
+    // Get results for key. Returns false if there is no fresh entry for key.
+    bool get(const Key& key, std::vector<TrackInfo>& tracks);
+
+    void put(const Key& key, const std::vector<TrackInfo>& tracks);
+
+    void clear();
+
+private:
+    struct Entry
+    {
+        Entry(const Key& key_p, const std::vector<TrackInfo>& tracks_p,
+            std::chrono::steady_clock::time_point expires_p)
+          : key(key_p), tracks(tracks_p), expires(expires_p)
+        {
+        }
+        Key key;
+        std::vector<TrackInfo> tracks;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    void erase(std::map<Key, std::list<Entry>::iterator>::iterator it);
+
+    const int capacity_;
+    const std::chrono::steady_clock::duration ttl_;
+    // Most recently used first
+    std::list<Entry> entries_;
+    std::map<Key, std::list<Entry>::iterator> index_;
+};
+
+}
+
+#endif
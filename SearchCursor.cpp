@@ -0,0 +1,144 @@
+#include "SpotifyBackstage.hpp"
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+
+namespace spotify_backstage {
+
+namespace {
+
+// Pages fetched so far. Shared with the search callbacks, which may outlive the cursor.
+struct Pages
+{
+    Pages() : mutex(), ready(), tracks()
+    {
+    }
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::map<int, std::vector<Track>> tracks;
+};
+
+}
+
+class SearchCursor::Impl
+{
+public:
+    Impl(SpotifyBackstage& backstage, const std::string& query, int page_size)
+      : backstage_(backstage),
+        query_(query),
+        page_size_(page_size),
+        index_(0),
+        pages_(std::make_shared<Pages>()),
+        requested_()
+    {
+        fetch(0);
+        fetch(1);
+    }
+
+    int getPageIndex() const
+    {
+        return index_;
+    }
+
+    bool isPageReady() const
+    {
+        std::lock_guard<std::mutex> lock(pages_->mutex);
+        return pages_->tracks.count(index_) > 0;
+    }
+
+    std::vector<Track> getPage()
+    {
+        return waitPage(index_);
+    }
+
+    bool next()
+    {
+        // A short page is the last one
+        if (static_cast<int>(waitPage(index_).size()) < page_size_ || waitPage(index_ + 1).empty())
+            return false;
+
+        ++index_;
+        fetch(index_ + 1);
+        return true;
+    }
+
+    bool previous()
+    {
+        if (index_ == 0)
+            return false;
+
+        --index_;
+        return true;
+    }
+
+private:
+    void fetch(int index)
+    {
+        if (!requested_.insert(index).second)
+            return;
+
+        auto pages = pages_;
+        backstage_.searchAsync(query_, page_size_, index * page_size_,
+            [pages, index](const std::vector<Track>& tracks)
+            {
+                std::lock_guard<std::mutex> lock(pages->mutex);
+                pages->tracks[index] = tracks;
+                pages->ready.notify_all();
+            });
+    }
+
+    std::vector<Track> waitPage(int index)
+    {
+        fetch(index);
+
+        std::unique_lock<std::mutex> lock(pages_->mutex);
+        pages_->ready.wait(lock, [this, index] { return pages_->tracks.count(index) > 0; });
+        return pages_->tracks[index];
+    }
+
+    SpotifyBackstage& backstage_;
+    const std::string query_;
+    const int page_size_;
+    int index_;
+    std::shared_ptr<Pages> pages_;
+    // Pages requested from backstage_
+    std::set<int> requested_;
+};
+
+SearchCursor::SearchCursor(SpotifyBackstage& backstage, const std::string& query, int page_size)
+  : impl_(new Impl(backstage, query, page_size))
+{
+}
+
+SearchCursor::~SearchCursor()
+{
+}
+
+int SearchCursor::getPageIndex() const
+{
+    return impl_->getPageIndex();
+}
+
+bool SearchCursor::isPageReady() const
+{
+    return impl_->isPageReady();
+}
+
+std::vector<Track> SearchCursor::getPage()
+{
+    return impl_->getPage();
+}
+
+bool SearchCursor::next()
+{
+    return impl_->next();
+}
+
+bool SearchCursor::previous()
+{
+    return impl_->previous();
+}
+
+}
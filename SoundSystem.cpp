@@ -1,258 +1,706 @@
 #include "SoundSystem.hpp"
 
+#include "AudioAllocations.hpp"
+#include "AudioBlockPool.hpp"
 #include "AudioDevice.hpp"
+#include "Channel.hpp"
+#include "Convolver.hpp"
 #include "Equalizer.hpp"
+#include "EventDispatcher.hpp"
+#include "GraphicEqualizer.hpp"
 #include "Logger.hpp"
+#include "NetworkSink.hpp"
+#include "OutputEqualizer.hpp"
+#include "ProcessorChain.hpp"
 #include "SpotifyBackstage.hpp"
+#include "StartupTimer.hpp"
+#include "ThreadSetup.hpp"
+#include "Variant.hpp"
+#include "WavFile.hpp"
+#include <algorithm>
+#include <atomic>
 #include <thread>
-#include <PolyM/Queue.hpp>
 
 namespace spotify_backstage {
 
+namespace {
+const int CHANNEL_SIZE = 64;
+// A write takes one block, and another for the network stream. Longer writes than a block are allocated.
+const int NUM_BLOCKS = 4;
+const int BLOCK_SIZE = 16384;
+
+// Processors in the chain before the ones added with addProcessor()
+const int NUM_BUILTIN_PROCESSORS = 2;
+}
+
 class SoundSystem::Impl
 {
 public:
-    Impl()
-      : audio_dev_(),
+    Impl(EventDispatcher& events, StartupTimer& startup, ThreadSetup& threads)
+      : events_(events),
+        startup_(startup),
+        threads_(threads),
+        out_eq_(),
+        audio_dev_(),
         eq_(),
-        msg_queue_(),
+        geq_(),
+        conv_(),
+        chain_(),
+        blocks_(NUM_BLOCKS, BLOCK_SIZE),
+        net_sink_(),
+        channel_(CHANNEL_SIZE),
+        flush_generation_(0),
+        time_to_silence_us_(0),
         useEq_(false),
+        lowLatencyEq_(false),
+        requestedLowLatencyEq_(false),
+        lowLatencySwitchPos_(0),
+        useGraphicEq_(false),
+        num_underruns_(0),
         thread_(&Impl::run, this)
     {
+        audio_dev_.setOutputEqualizer(&out_eq_);
+
+        // The big buffers touched on every period. The rest of the audio path state is small and used all the time.
+        threads_.lockMemory(audio_dev_.getBufferMemory(), audio_dev_.getBufferMemorySize());
+        threads_.lockMemory(blocks_.getMemory(), blocks_.getMemorySize());
     }
 
     ~Impl()
     {
         LOG("SoundSystem dtor");
-        msg_queue_.put(PolyM::Msg(MSG_TERMINATE));
+        ++flush_generation_;
+        channel_.put(Terminate(), Channel<Msg>::PRIORITY);
         thread_.join();
         LOG("SoundSystem thread finished");
     }
 
     int getCurrentOutputDevice()
     {
-        auto response = msg_queue_.request(PolyM::Msg(MSG_GET_CURRENT_OUTPUT_DEVICE));
-        return dynamic_cast<PolyM::DataMsg<int>&>(*response).getPayload();
+        Reply<int> reply;
+        channel_.put(GetCurrentOutputDevice{&reply});
+        return reply.wait();
     }
 
     EqState getEqState()
     {
-        auto response = msg_queue_.request(PolyM::Msg(MSG_GET_EQ_STATE));
-        return dynamic_cast<PolyM::DataMsg<EqState>&>(*response).getPayload();
+        Reply<EqState> reply;
+        channel_.put(GetEqState{&reply});
+        return reply.wait();
     }
 
     std::vector<std::pair<int, std::string>> getOutputDevices()
     {
-        auto response = msg_queue_.request(PolyM::Msg(MSG_GET_OUTPUT_DEVICES));
-        return dynamic_cast<PolyM::DataMsg<std::vector<std::pair<int, std::string>>>&>(*response).getPayload();
+        Reply<std::vector<std::pair<int, std::string>>> reply;
+        channel_.put(GetOutputDevices{&reply});
+        return reply.wait();
+    }
+
+    void refreshOutputDevices()
+    {
+        channel_.put(RefreshOutputDevices(), Channel<Msg>::PRIORITY);
+    }
+
+    void flush(std::chrono::steady_clock::time_point requested)
+    {
+        // Cancels the writes already queued
+        ++flush_generation_;
+        channel_.put(Flush{requested}, Channel<Msg>::PRIORITY);
+    }
+
+    std::chrono::microseconds getTimeToSilence() const
+    {
+        return std::chrono::microseconds(time_to_silence_us_);
+    }
+
+    // Like flush, but the output restarts with a short prebuffer, as the playback continues right away
+    void discard()
+    {
+        ++flush_generation_;
+        channel_.put(Discard(), Channel<Msg>::PRIORITY);
     }
 
-    void flush()
+    void pause()
     {
-        msg_queue_.put(PolyM::Msg(MSG_FLUSH));
+        channel_.put(Pause(), Channel<Msg>::PRIORITY);
+    }
+
+    void resume()
+    {
+        channel_.put(Resume(), Channel<Msg>::PRIORITY);
     }
 
     void setEqOn(bool on)
     {
-        msg_queue_.put(PolyM::DataMsg<bool>(MSG_SET_EQ_ON, on));
+        channel_.put(SetEqOn{on});
+    }
+
+    void setLowLatencyEq(bool on)
+    {
+        channel_.put(SetLowLatencyEq{on});
     }
 
     void setGain(double gain)
     {
-        msg_queue_.put(PolyM::DataMsg<double>(MSG_SET_GAIN, gain));
+        channel_.put(SetGain{gain});
     }
 
     void setBass(double bass)
     {
-        msg_queue_.put(PolyM::DataMsg<double>(MSG_SET_BASS, bass));
+        channel_.put(SetBass{bass});
     }
 
     void setMid(double mid)
     {
-        msg_queue_.put(PolyM::DataMsg<double>(MSG_SET_MID, mid));
+        channel_.put(SetMid{mid});
     }
 
     void setTreble(double treble)
     {
-        msg_queue_.put(PolyM::DataMsg<double>(MSG_SET_TREBLE, treble));
+        channel_.put(SetTreble{treble});
+    }
+
+    void setGraphicEqBands(const std::vector<double>& bands)
+    {
+        channel_.put(SetGraphicEqBands{bands});
+    }
+
+    void setGraphicEqBand(int band, double gain)
+    {
+        channel_.put(SetGraphicEqBand{band, gain});
+    }
+
+    bool setRoomCorrection(const std::string& wav_path)
+    {
+        // Read the file here to keep the file access out of SoundSystem thread
+        WavData response;
+        if (!wav_path.empty() && !readWav(wav_path, response))
+            return false;
+
+        channel_.put(SetImpulseResponse{std::move(response)});
+        return true;
     }
 
     void setOutputDevice(int dev)
     {
-        msg_queue_.put(PolyM::DataMsg<int>(MSG_SET_OUTPUT_DEVICE, dev));
+        channel_.put(SetOutputDevice{dev}, Channel<Msg>::PRIORITY);
+    }
+
+    int startNetworkStream(int port)
+    {
+        // Open the socket here to be able to return the port, the sink is then handed over to SoundSystem thread
+        std::unique_ptr<NetworkSink> sink(new NetworkSink(port));
+        if (!sink->isOpen())
+            return -1;
+
+        const auto actual_port = sink->getPort();
+        channel_.put(SetNetworkSink{std::move(sink)});
+        return actual_port;
+    }
+
+    void stopNetworkStream()
+    {
+        channel_.put(SetNetworkSink{nullptr});
+    }
+
+    void addProcessor(std::shared_ptr<AudioProcessor> processor)
+    {
+        channel_.put(AddProcessor{std::move(processor)});
+    }
+
+    void clearProcessors()
+    {
+        channel_.put(ClearProcessors());
+    }
+
+    unsigned getGeneration() const
+    {
+        return flush_generation_;
     }
 
-    bool write(int sample_rate, int num_channels, const int16_t* data, int num_frames)
+    bool write(int sample_rate, int num_channels, const int16_t* data, int num_frames, unsigned generation)
     {
-        auto response = msg_queue_.request(
-            PolyM::DataMsg<Audio>(MSG_WRITE, sample_rate, num_channels, data, num_frames));
-        return dynamic_cast<PolyM::DataMsg<bool>&>(*response).getPayload();
+        // The data stays valid until the reply, as this waits for it
+        Reply<bool> reply;
+        channel_.put(Write{sample_rate, num_channels, data, num_frames, generation, &reply});
+        return reply.wait();
     }
 
 private:
-    // SoundSystem message types
-    enum MsgType
-    {
-        MSG_TERMINATE,
-        MSG_GET_CURRENT_OUTPUT_DEVICE,
-        MSG_GET_CURRENT_OUTPUT_DEVICE_RESPONSE,
-        MSG_GET_OUTPUT_DEVICES,
-        MSG_GET_OUTPUT_DEVICES_RESPONSE,
-        MSG_SET_OUTPUT_DEVICE,
-        MSG_GET_EQ_STATE,
-        MSG_GET_EQ_STATE_RESPONSE,
-        MSG_SET_EQ_ON,
-        MSG_SET_GAIN,
-        MSG_SET_BASS,
-        MSG_SET_MID,
-        MSG_SET_TREBLE,
-        MSG_WRITE,
-        MSG_WRITE_RESPONSE,
-        MSG_FLUSH
+    // SoundSystem messages. Requests carry a pointer to the Reply the requester waits on.
+
+    struct Terminate
+    {
     };
 
-    struct Audio
+    struct GetCurrentOutputDevice
     {
-        Audio(int fs, int n_ch, const int16_t* audio_data, int n_fr)
-          : sample_rate(fs), num_channels(n_ch), data(audio_data, audio_data + n_ch * n_fr)
-        {
-        }
+        Reply<int>* reply;
+    };
+
+    struct GetOutputDevices
+    {
+        Reply<std::vector<std::pair<int, std::string>>>* reply;
+    };
 
+    struct SetOutputDevice
+    {
+        int dev;
+    };
+
+    struct RefreshOutputDevices
+    {
+    };
+
+    struct GetEqState
+    {
+        Reply<EqState>* reply;
+    };
+
+    struct SetEqOn
+    {
+        bool on;
+    };
+
+    struct SetLowLatencyEq
+    {
+        bool on;
+    };
+
+    struct SetGain
+    {
+        double gain;
+    };
+
+    struct SetBass
+    {
+        double bass;
+    };
+
+    struct SetMid
+    {
+        double mid;
+    };
+
+    struct SetTreble
+    {
+        double treble;
+    };
+
+    struct SetGraphicEqBands
+    {
+        std::vector<double> bands;
+    };
+
+    struct SetGraphicEqBand
+    {
+        int band;
+        double gain;
+    };
+
+    struct SetImpulseResponse
+    {
+        WavData response;
+    };
+
+    struct Write
+    {
         int sample_rate;
         int num_channels;
-        std::vector<int16_t> data;
+        const int16_t* data;
+        int num_frames;
+        // Flush generation at the time of writing. Audio from before a flush is dropped.
+        unsigned generation;
+        Reply<bool>* reply;
+    };
+
+    struct Flush
+    {
+        std::chrono::steady_clock::time_point requested;
+    };
+
+    struct Discard
+    {
+    };
+
+    struct Pause
+    {
+    };
+
+    struct Resume
+    {
+    };
+
+    struct SetNetworkSink
+    {
+        std::unique_ptr<NetworkSink> sink;
+    };
+
+    struct AddProcessor
+    {
+        std::shared_ptr<AudioProcessor> processor;
+    };
+
+    struct ClearProcessors
+    {
+    };
+
+    typedef Variant<Terminate, GetCurrentOutputDevice, GetOutputDevices, SetOutputDevice, RefreshOutputDevices, GetEqState, SetEqOn,
+        SetLowLatencyEq, SetGain, SetBass, SetMid, SetTreble, SetGraphicEqBands, SetGraphicEqBand, SetImpulseResponse,
+        Write, Flush, Discard, Pause, Resume, SetNetworkSink, AddProcessor, ClearProcessors> Msg;
+
+    // Calls the handler for each message type. The handler is picked at compile time.
+    struct Dispatch
+    {
+        void operator()(Terminate&) { keep_running = false; }
+        void operator()(GetCurrentOutputDevice& msg) { impl.handleGetCurrentOutputDevice(*msg.reply); }
+        void operator()(GetOutputDevices& msg) { impl.handleGetOutputDevices(*msg.reply); }
+        void operator()(SetOutputDevice& msg) { impl.handleSetOutputDevice(msg.dev); }
+        void operator()(RefreshOutputDevices&) { impl.handleRefreshOutputDevices(); }
+        void operator()(GetEqState& msg) { impl.handleGetEqState(*msg.reply); }
+        void operator()(SetEqOn& msg) { impl.handleSetEqOn(msg.on); }
+        void operator()(SetLowLatencyEq& msg) { impl.handleSetLowLatencyEq(msg.on); }
+        void operator()(SetGain& msg) { impl.handleSetGain(msg.gain); }
+        void operator()(SetBass& msg) { impl.handleSetBass(msg.bass); }
+        void operator()(SetMid& msg) { impl.handleSetMid(msg.mid); }
+        void operator()(SetTreble& msg) { impl.handleSetTreble(msg.treble); }
+        void operator()(SetGraphicEqBands& msg) { impl.handleSetGraphicEqBands(msg.bands); }
+        void operator()(SetGraphicEqBand& msg) { impl.handleSetGraphicEqBand(msg.band, msg.gain); }
+        void operator()(SetImpulseResponse& msg) { impl.handleSetImpulseResponse(msg.response); }
+        void operator()(Write& msg) { impl.handleWrite(msg); }
+        void operator()(Flush& msg) { impl.handleFlush(msg.requested); }
+        void operator()(Discard&) { impl.handleDiscard(); }
+        void operator()(Pause&) { impl.audio_dev_.pause(); }
+        void operator()(Resume&) { impl.audio_dev_.resume(); }
+        void operator()(SetNetworkSink& msg) { impl.handleSetNetworkSink(msg.sink); }
+        void operator()(AddProcessor& msg) { impl.chain_.add(std::move(msg.processor)); }
+        void operator()(ClearProcessors&) { impl.chain_.erase(NUM_BUILTIN_PROCESSORS); }
+
+        Impl& impl;
+        bool keep_running;
+    };
+
+    // Equalizer stage of chain_. Skipped when the equalizer is off, or run at the output in the low latency mode.
+    class EqProcessor : public AudioProcessor
+    {
+    public:
+        explicit EqProcessor(Impl& impl) : impl_(impl)
+        {
+        }
+
+        void process(int16_t* data, int num_samples, int num_channels, int sample_rate) override
+        {
+            if (impl_.useEq_ && !impl_.lowLatencyEq_)
+                impl_.equalize(data, num_samples, num_channels, sample_rate);
+        }
+
+    private:
+        Impl& impl_;
+    };
+
+    // Room correction stage of chain_
+    class ConvolverProcessor : public AudioProcessor
+    {
+    public:
+        explicit ConvolverProcessor(Convolver& conv) : conv_(conv)
+        {
+        }
+
+        void process(int16_t* data, int num_samples, int num_channels, int sample_rate) override
+        {
+            conv_.process(data, num_samples, num_channels, sample_rate);
+        }
+
+        void reset() override
+        {
+            conv_.reset();
+        }
+
+    private:
+        Convolver& conv_;
     };
 
     void run()
     {
-        auto keepRunning = true;
-        while (keepRunning)
+        threads_.apply(ThreadSetup::AUDIO);
+        // This thread waits for the equalizer threads, so they run with the same priority
+        eq_.setThreadInit([this] { threads_.applyToHelper(ThreadSetup::AUDIO); });
+
+        // chain_ is only used in this thread, so it's set up here
+        chain_.add(std::shared_ptr<AudioProcessor>(new EqProcessor(*this)));
+        chain_.add(std::shared_ptr<AudioProcessor>(new ConvolverProcessor(conv_)));
+
+        // Initializing the device may take long, so it's done here instead of the constructor.
+        // Messages sent meanwhile wait in the channel.
+        audio_dev_.open();
+        startup_.mark(StartupTimer::AUDIO_INITIALIZED);
+
+        Dispatch dispatch{*this, true};
+        Msg msg;
+
+        while (dispatch.keep_running)
         {
-            auto msg = msg_queue_.get();
-            switch (msg->getMsgId())
-            {
-            case MSG_TERMINATE:
-                keepRunning = false;
-                break;
-            case MSG_GET_CURRENT_OUTPUT_DEVICE:
-                handleGetCurrentOutputDevice(msg->getUniqueId());
-                break;
-            case MSG_GET_OUTPUT_DEVICES:
-                handleGetOutputDevices(msg->getUniqueId());
-                break;
-            case MSG_SET_OUTPUT_DEVICE:
-                handleSetOutputDevice(dynamic_cast<PolyM::DataMsg<int>&>(*msg).getPayload());
-                break;
-            case MSG_GET_EQ_STATE:
-                handleGetEqState(msg->getUniqueId());
-                break;
-            case MSG_SET_EQ_ON:
-                handleSetEqOn(dynamic_cast<PolyM::DataMsg<bool>&>(*msg).getPayload());
-                break;
-            case MSG_SET_GAIN:
-                handleSetGain(dynamic_cast<PolyM::DataMsg<double>&>(*msg).getPayload());
-                break;
-            case MSG_SET_BASS:
-                handleSetBass(dynamic_cast<PolyM::DataMsg<double>&>(*msg).getPayload());
-                break;
-            case MSG_SET_MID:
-                handleSetMid(dynamic_cast<PolyM::DataMsg<double>&>(*msg).getPayload());
-                break;
-            case MSG_SET_TREBLE:
-                handleSetTreble(dynamic_cast<PolyM::DataMsg<double>&>(*msg).getPayload());
-                break;
-            case MSG_WRITE:
-                handleWrite(dynamic_cast<PolyM::DataMsg<Audio>&>(*msg));
-                break;
-            case MSG_FLUSH:
-                handleFlush();
-                break;
-            }
+            channel_.get(msg);
+            msg.visit(dispatch);
         }
 
         LOG("Shutting down SoundSystem");
     }
 
-    void handleGetCurrentOutputDevice(PolyM::MsgUID reqUid)
+    void handleGetCurrentOutputDevice(Reply<int>& reply)
     {
-        msg_queue_.respondTo(reqUid, PolyM::DataMsg<int>(MSG_GET_CURRENT_OUTPUT_DEVICE_RESPONSE,
-            audio_dev_.getCurrentOutputDevice()));
+        reply.set(audio_dev_.getCurrentOutputDevice());
     }
 
-    void handleGetOutputDevices(PolyM::MsgUID reqUid)
+    void handleGetOutputDevices(Reply<std::vector<std::pair<int, std::string>>>& reply)
     {
-        msg_queue_.respondTo(reqUid,
-            PolyM::DataMsg<std::vector<std::pair<int, std::string>>>(
-                MSG_GET_OUTPUT_DEVICES_RESPONSE, audio_dev_.getOutputDevices()));
+        reply.set(audio_dev_.getOutputDevices());
     }
 
     void handleSetOutputDevice(int dev)
     {
+        const auto old_dev = audio_dev_.getCurrentOutputDevice();
         audio_dev_.setOutputDevice(dev);
+
+        if (audio_dev_.getCurrentOutputDevice() != old_dev)
+            events_.post(Event::DEVICE_CHANGED, audio_dev_.getCurrentOutputDevice());
     }
 
-    void handleGetEqState(PolyM::MsgUID reqUid)
+    void handleRefreshOutputDevices()
     {
-        msg_queue_.respondTo(reqUid, PolyM::DataMsg<EqState>(MSG_GET_EQ_STATE_RESPONSE,
-            useEq_, eq_.getGain(), eq_.getBass(), eq_.getMid(), eq_.getTreble()));
+        const auto old_dev = audio_dev_.getCurrentOutputDevice();
+        audio_dev_.refreshOutputDevices();
+
+        if (audio_dev_.getCurrentOutputDevice() != old_dev)
+            events_.post(Event::DEVICE_CHANGED, audio_dev_.getCurrentOutputDevice());
     }
 
+    void handleGetEqState(Reply<EqState>& reply)
+    {
+        reply.set(EqState(useEq_, eq_.getGain(), eq_.getBass(), eq_.getMid(), eq_.getTreble(), requestedLowLatencyEq_,
+            useGraphicEq_ ? geq_.getBandGains() : std::vector<double>()));
+    }
+
+    // The parameters are always kept in sync in both equalizers, so that the mode can be switched any time
+
     void handleSetEqOn(bool on)
     {
         useEq_ = on;
+        out_eq_.setOn(useEq_);
+    }
+
+    void handleSetLowLatencyEq(bool on)
+    {
+        requestedLowLatencyEq_ = on;
+        switchLowLatencyEq();
+    }
+
+    // The audio already in the buffer was processed in the old mode. The output equalizer switches
+    // when the playback reaches the audio written after the switch. Until then, another switch waits,
+    // and is made on a later write.
+    void switchLowLatencyEq()
+    {
+        if (requestedLowLatencyEq_ == lowLatencyEq_ || audio_dev_.getReadPosition() < lowLatencySwitchPos_)
+            return;
+
+        lowLatencyEq_ = requestedLowLatencyEq_;
+        lowLatencySwitchPos_ = audio_dev_.getWritePosition();
+        out_eq_.setLowLatency(lowLatencyEq_, lowLatencySwitchPos_);
     }
 
     void handleSetGain(double gain)
     {
         eq_.setGain(gain);
+        geq_.setGain(gain);
+        out_eq_.setGain(gain);
     }
 
     void handleSetBass(double bass)
     {
         eq_.setBass(bass);
+        out_eq_.setBass(bass);
     }
 
     void handleSetMid(double mid)
     {
         eq_.setMid(mid);
+        out_eq_.setMid(mid);
     }
 
     void handleSetTreble(double treble)
     {
         eq_.setTreble(treble);
+        out_eq_.setTreble(treble);
+    }
+
+    void handleSetGraphicEqBands(const std::vector<double>& bands)
+    {
+        if (bands.empty())
+        {
+            useGraphicEq_ = false;
+            out_eq_.setNumBands(0);
+            return;
+        }
+
+        if (!geq_.setNumBands(bands.size()))
+            return;
+
+        useGraphicEq_ = true;
+        out_eq_.setNumBands(bands.size());
+
+        for (int i = 0; i < static_cast<int>(bands.size()); ++i)
+        {
+            geq_.setBandGain(i, bands[i]);
+            out_eq_.setBandGain(i, bands[i]);
+        }
     }
 
-    void handleWrite(PolyM::DataMsg<Audio>& msg)
+    void handleSetGraphicEqBand(int band, double gain)
     {
+        if (!useGraphicEq_)
+            return;
+
+        geq_.setBandGain(band, gain);
+        out_eq_.setBandGain(band, gain);
+    }
+
+    void handleSetImpulseResponse(const WavData& response)
+    {
+        conv_.setImpulseResponse(response.samples, response.num_channels, response.sample_rate);
+    }
+
+    void handleWrite(const Write& msg)
+    {
+        AudioAllocations::Scope counted;
+
         //LOG(audio_dev_.getWriteAvailable());
-        Audio& audio = msg.getPayload();
-        if (audio_dev_.getWriteAvailable() >= static_cast<int>(audio.data.size()))
+        if (msg.generation != flush_generation_)
+        {
+            // Flushed while queued, drop without processing
+            msg.reply->set(true);
+            return;
+        }
+
+        const int num_samples = msg.num_frames * msg.num_channels;
+        if (audio_dev_.getWriteAvailable() >= num_samples)
         {
-            msg_queue_.respondTo(msg.getUniqueId(), PolyM::DataMsg<bool>(MSG_WRITE_RESPONSE, true));
+            switchLowLatencyEq();
 
-            if (useEq_)
-                eq_.equalize(audio.data, audio.num_channels);
+            // The writer's data is only valid until the reply
+            const auto block = copyToBlock(msg.sample_rate, msg.num_channels, msg.data, num_samples);
+            auto& audio = *block;
+            msg.reply->set(true);
 
-            audio_dev_.write(audio.sample_rate, audio.num_channels, audio.data);
+            chain_.process(audio.data, audio.size, audio.num_channels, audio.sample_rate);
+
+            // Don't let the audio start the device if a flush came in during processing
+            if (msg.generation != flush_generation_)
+                return;
+
+            audio_dev_.write(audio.sample_rate, audio.num_channels, audio.data, audio.size);
+            startup_.mark(StartupTimer::FIRST_AUDIO);
+
+            if (net_sink_)
+                writeNetworkSink(audio);
+
+            // Underruns are counted in the audio callback, and reported from here to keep the callback light
+            const auto num_underruns = audio_dev_.getNumUnderruns();
+            if (num_underruns != num_underruns_)
+            {
+                num_underruns_ = num_underruns;
+                events_.post(Event::UNDERRUN, num_underruns_);
+            }
         }
         else
-            msg_queue_.respondTo(msg.getUniqueId(), PolyM::DataMsg<bool>(MSG_WRITE_RESPONSE, false));
+            msg.reply->set(false);
     }
 
-    void handleFlush()
+    AudioBlockRef copyToBlock(int sample_rate, int num_channels, const int16_t* data, int num_samples)
+    {
+        auto block = blocks_.acquire(num_samples);
+        block->sample_rate = sample_rate;
+        block->num_channels = num_channels;
+        block->size = num_samples;
+        std::copy(data, data + num_samples, block->data);
+        return block;
+    }
+
+    void equalize(int16_t* data, int num_samples, int num_channels, int sample_rate)
+    {
+        if (useGraphicEq_)
+            geq_.equalize(data, num_samples, num_channels, sample_rate);
+        else
+            eq_.equalize(data, num_samples, num_channels);
+    }
+
+    void writeNetworkSink(const AudioBlock& audio)
+    {
+        if (useEq_ && lowLatencyEq_)
+        {
+            // The audio going to the device is equalized only at the output, the network stream needs its own pass
+            const auto net_block = copyToBlock(audio.sample_rate, audio.num_channels, audio.data, audio.size);
+            equalize(net_block->data, net_block->size, net_block->num_channels, net_block->sample_rate);
+            net_sink_->write(audio.sample_rate, audio.num_channels, net_block->data, net_block->size);
+        }
+        else
+            net_sink_->write(audio.sample_rate, audio.num_channels, audio.data, audio.size);
+    }
+
+    void handleFlush(std::chrono::steady_clock::time_point requested)
     {
         audio_dev_.flush();
+        time_to_silence_us_ = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - requested).count();
+        LOG("Time to silence " << time_to_silence_us_ << " us");
+
+        chain_.reset();
+        switchLowLatencyEq();
+    }
+
+    void handleDiscard()
+    {
+        audio_dev_.flush(true);
+        chain_.reset();
+        switchLowLatencyEq();
     }
 
+    void handleSetNetworkSink(std::unique_ptr<NetworkSink>& sink)
+    {
+        net_sink_ = std::move(sink);
+    }
+
+    EventDispatcher& events_;
+    StartupTimer& startup_;
+    ThreadSetup& threads_;
+    // Declared before audio_dev_, as it's used by the device until the device is destroyed
+    OutputEqualizer out_eq_;
     AudioDevice audio_dev_;
     Equalizer eq_;
-    PolyM::Queue msg_queue_;
+    GraphicEqualizer geq_;
+    Convolver conv_;
+    // Processing stages from the equalizer on, run on each block before it goes to the device
+    ProcessorChain chain_;
+    // Audio being processed
+    AudioBlockPool blocks_;
+    std::unique_ptr<NetworkSink> net_sink_;
+    // Output device changes and flushes go in the priority lane, ahead of writes
+    Channel<Msg> channel_;
+    // Incremented by every flush. Writes queued before a flush are dropped.
+    std::atomic<unsigned> flush_generation_;
+    std::atomic<long long> time_to_silence_us_;
     bool useEq_;
+    // Mode the written audio is processed in, and the mode last asked for
+    bool lowLatencyEq_;
+    bool requestedLowLatencyEq_;
+    // Buffer write position of the latest mode switch
+    long long lowLatencySwitchPos_;
+    bool useGraphicEq_;
+    long long num_underruns_;
     std::thread thread_;
 };
 
-SoundSystem::SoundSystem()
-  : impl_(new Impl)
+SoundSystem::SoundSystem(EventDispatcher& events, StartupTimer& startup, ThreadSetup& threads)
+  : impl_(new Impl(events, startup, threads))
 {
 }
 
@@ -275,9 +723,44 @@ std::vector<std::pair<int, std::string>> SoundSystem::getOutputDevices()
     return impl_->getOutputDevices();
 }
 
-void SoundSystem::flush()
+void SoundSystem::refreshOutputDevices()
+{
+    impl_->refreshOutputDevices();
+}
+
+void SoundSystem::flush(std::chrono::steady_clock::time_point requested)
+{
+    impl_->flush(requested);
+}
+
+std::chrono::microseconds SoundSystem::getTimeToSilence() const
+{
+    return impl_->getTimeToSilence();
+}
+
+void SoundSystem::discard()
+{
+    impl_->discard();
+}
+
+void SoundSystem::pause()
 {
-    impl_->flush();
+    impl_->pause();
+}
+
+void SoundSystem::resume()
+{
+    impl_->resume();
+}
+
+void SoundSystem::addProcessor(std::shared_ptr<AudioProcessor> processor)
+{
+    impl_->addProcessor(std::move(processor));
+}
+
+void SoundSystem::clearProcessors()
+{
+    impl_->clearProcessors();
 }
 
 void SoundSystem::setEqOn(bool on)
@@ -285,6 +768,11 @@ void SoundSystem::setEqOn(bool on)
     impl_->setEqOn(on);
 }
 
+void SoundSystem::setLowLatencyEq(bool on)
+{
+    impl_->setLowLatencyEq(on);
+}
+
 void SoundSystem::setGain(double gain)
 {
     impl_->setGain(gain);
@@ -305,14 +793,44 @@ void SoundSystem::setTreble(double treble)
     impl_->setTreble(treble);
 }
 
+void SoundSystem::setGraphicEqBands(const std::vector<double>& bands)
+{
+    impl_->setGraphicEqBands(bands);
+}
+
+void SoundSystem::setGraphicEqBand(int band, double gain)
+{
+    impl_->setGraphicEqBand(band, gain);
+}
+
+bool SoundSystem::setRoomCorrection(const std::string& wav_path)
+{
+    return impl_->setRoomCorrection(wav_path);
+}
+
 void SoundSystem::setOutputDevice(int dev)
 {
     impl_->setOutputDevice(dev);
 }
 
-bool SoundSystem::write(int sample_rate, int num_channels, const int16_t* data, int num_frames)
+int SoundSystem::startNetworkStream(int port)
+{
+    return impl_->startNetworkStream(port);
+}
+
+void SoundSystem::stopNetworkStream()
+{
+    impl_->stopNetworkStream();
+}
+
+unsigned SoundSystem::getGeneration() const
+{
+    return impl_->getGeneration();
+}
+
+bool SoundSystem::write(int sample_rate, int num_channels, const int16_t* data, int num_frames, unsigned generation)
 {
-    return impl_->write(sample_rate, num_channels, data, num_frames);
+    return impl_->write(sample_rate, num_channels, data, num_frames, generation);
 }
 
 }
@@ -1,6 +1,7 @@
 #ifndef SPOTIFY_BACKSTAGE_SOUNDSYSTEM_HPP
 #define SPOTIFY_BACKSTAGE_SOUNDSYSTEM_HPP
 
+#include <chrono>
 #include <cstdint>
 #include <memory>
 #include <string>
@@ -9,24 +10,43 @@
 
 namespace spotify_backstage {
 
+class AudioProcessor;
+class EventDispatcher;
+class StartupTimer;
+class ThreadSetup;
 struct EqState;
 
 class SoundSystem
 {
 public:
-    SoundSystem();
+    SoundSystem(EventDispatcher& events, StartupTimer& startup, ThreadSetup& threads);
     ~SoundSystem();
     int getCurrentOutputDevice();
     EqState getEqState();
     std::vector<std::pair<int, std::string>> getOutputDevices();
-    void flush();
+    void refreshOutputDevices();
+    void flush(std::chrono::steady_clock::time_point requested = std::chrono::steady_clock::now());
+    std::chrono::microseconds getTimeToSilence() const;
+    void discard();
+    void pause();
+    void resume();
     void setEqOn(bool on);
+    void setLowLatencyEq(bool on);
     void setGain(double gain);
     void setBass(double bass);
     void setMid(double mid);
     void setTreble(double treble);
+    void setGraphicEqBands(const std::vector<double>& bands);
+    void setGraphicEqBand(int band, double gain);
+    bool setRoomCorrection(const std::string& wav_path);
     void setOutputDevice(int dev);
-    bool write(int sample_rate, int num_channels, const int16_t* data, int num_frames);
+    int startNetworkStream(int port);
+    void stopNetworkStream();
+    void addProcessor(std::shared_ptr<AudioProcessor> processor);
+    void clearProcessors();
+    // Incremented by every flush and discard. A write made with an older generation is dropped.
+    unsigned getGeneration() const;
+    bool write(int sample_rate, int num_channels, const int16_t* data, int num_frames, unsigned generation);
 
 private:
     class Impl;
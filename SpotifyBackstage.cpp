@@ -1,38 +1,137 @@
 #include "SpotifyBackstage.hpp"
 
+#include "AudioAllocations.hpp"
+#include "AudioBlockPool.hpp"
+#include "EventDispatcher.hpp"
+#include "GraphicEqualizer.hpp"
 #include "SoundSystem.hpp"
 #include "SpotifySession.hpp"
+#include "StartupTimer.hpp"
+#include "StringTable.hpp"
+#include "ThreadSetup.hpp"
 
 namespace spotify_backstage
 {
 
+namespace {
+
+// Callback that passes the tracks to promise
+TracksCallback fulfill(const std::shared_ptr<std::promise<std::vector<Track>>>& promise)
+{
+    return [promise](const std::vector<Track>& tracks) { promise->set_value(tracks); };
+}
+
+}
+
 class SpotifyBackstage::Impl
 {
 public:
-    Impl(const std::string& username, const std::string& password)
-      : sounds_(), spotify_(username, password, sounds_)
+    Impl(const std::string& username, const std::string& password, const Config& config)
+      : startup_(),
+        threads_(config),
+        events_(),
+        sounds_(events_, startup_, threads_),
+        spotify_(username, password, sounds_, events_, startup_, threads_, config)
     {
+        startup_.mark(StartupTimer::CONSTRUCTED);
     }
 
     ~Impl()
     {
     }
 
+    int getEventFd()
+    {
+        return spotify_.getEventFd();
+    }
+
+    int processEvents()
+    {
+        return spotify_.processEvents();
+    }
+
+    StartupTimes getStartupTimes()
+    {
+        return startup_.getTimes();
+    }
+
+    RealtimeStatus getRealtimeStatus()
+    {
+        return threads_.getStatus();
+    }
+
     EqState getEqState()
     {
         return sounds_.getEqState();
     }
 
+    int subscribe(const EventCallback& callback)
+    {
+        return events_.subscribe(callback);
+    }
+
+    void unsubscribe(int id)
+    {
+        events_.unsubscribe(id);
+    }
+
     std::vector<Track> getPlayQueue()
     {
         return spotify_.getPlayQueue();
     }
 
+    std::future<std::vector<Track>> getPlayQueueAsync()
+    {
+        auto promise = std::make_shared<std::promise<std::vector<Track>>>();
+        spotify_.getPlayQueueAsync(fulfill(promise));
+        return promise->get_future();
+    }
+
+    void getPlayQueueAsync(const TracksCallback& callback)
+    {
+        spotify_.getPlayQueueAsync(callback);
+    }
+
+    std::shared_ptr<const PlayQueueSnapshot> getPlayQueueSnapshot()
+    {
+        return spotify_.getPlayQueueSnapshot();
+    }
+
     void enqueue(const std::string& uri)
     {
         spotify_.enqueue(uri);
     }
 
+    void enqueue(const std::vector<std::string>& uris)
+    {
+        spotify_.enqueue(uris);
+    }
+
+    void setTracksLoadedCallback(const TracksCallback& callback)
+    {
+        spotify_.setTracksLoadedCallback(callback);
+    }
+
+    void insert(int index, const std::string& uri)
+    {
+        spotify_.insert(index, uri);
+    }
+
+    void remove(int index)
+    {
+        spotify_.remove(index);
+    }
+
+    void move(int from, int to)
+    {
+        spotify_.move(from, to);
+    }
+
+    void shuffle()
+    {
+        spotify_.shuffle();
+    }
+
     void play()
     {
         spotify_.play();
@@ -43,6 +142,26 @@ public:
         spotify_.stop();
     }
 
+    void pause()
+    {
+        spotify_.pause();
+    }
+
+    void resume()
+    {
+        spotify_.resume();
+    }
+
+    void seek(int position_ms)
+    {
+        spotify_.seek(position_ms);
+    }
+
+    std::chrono::microseconds getTimeToSilence()
+    {
+        return sounds_.getTimeToSilence();
+    }
+
     void next()
     {
         spotify_.next();
@@ -53,11 +172,28 @@ public:
         return spotify_.search(query, num_results, offset);
     }
 
+    std::future<std::vector<Track>> searchAsync(const std::string& query, int num_results, int offset)
+    {
+        auto promise = std::make_shared<std::promise<std::vector<Track>>>();
+        spotify_.searchAsync(query, num_results, offset, fulfill(promise));
+        return promise->get_future();
+    }
+
+    void searchAsync(const std::string& query, int num_results, int offset, const TracksCallback& callback)
+    {
+        spotify_.searchAsync(query, num_results, offset, callback);
+    }
+
     void setEqOn(bool on)
     {
         sounds_.setEqOn(on);
     }
 
+    void setLowLatencyEq(bool on)
+    {
+        sounds_.setLowLatencyEq(on);
+    }
+
     void setGain(double gain)
     {
         sounds_.setGain(gain);
@@ -78,6 +214,21 @@ public:
         sounds_.setTreble(treble);
     }
 
+    void setGraphicEqBands(const std::vector<double>& bands)
+    {
+        sounds_.setGraphicEqBands(bands);
+    }
+
+    void setGraphicEqBand(int band, double level)
+    {
+        sounds_.setGraphicEqBand(band, level);
+    }
+
+    bool setRoomCorrection(const std::string& wav_path)
+    {
+        return sounds_.setRoomCorrection(wav_path);
+    }
+
     int getCurrentOutputDevice()
     {
         return sounds_.getCurrentOutputDevice();
@@ -88,18 +239,68 @@ public:
         return sounds_.getOutputDevices();
     }
 
+    void refreshOutputDevices()
+    {
+        sounds_.refreshOutputDevices();
+    }
+
     void setOutputDevice(int dev)
     {
         sounds_.setOutputDevice(dev);
     }
 
+    int startNetworkStream(int port)
+    {
+        return sounds_.startNetworkStream(port);
+    }
+
+    void stopNetworkStream()
+    {
+        sounds_.stopNetworkStream();
+    }
+
+    long long getNumAudioPoolMisses()
+    {
+        return AudioBlockPool::getNumMisses();
+    }
+
+    long long getNumAudioAllocations()
+    {
+        return AudioAllocations::getCount();
+    }
+
+    void addAudioProcessor(std::shared_ptr<AudioProcessor> processor)
+    {
+        sounds_.addProcessor(std::move(processor));
+    }
+
+    void clearAudioProcessors()
+    {
+        sounds_.clearProcessors();
+    }
+
+    void render(const std::vector<std::string>& uris, const std::string& path, const RenderCallback& callback)
+    {
+        spotify_.render(uris, path, sounds_.getEqState(), callback);
+    }
+
 private:
+    // Declared first, to start timing before anything else is constructed
+    StartupTimer startup_;
+    ThreadSetup threads_;
+    // Declared before the others, as they post events to it until they are destroyed
+    EventDispatcher events_;
     SoundSystem sounds_;
     SpotifySession spotify_;
 };
 
 SpotifyBackstage::SpotifyBackstage(const std::string& username, const std::string& password)
-  : impl_(new Impl(username, password))
+  : impl_(new Impl(username, password, Config()))
+{
+}
+
+SpotifyBackstage::SpotifyBackstage(const std::string& username, const std::string& password, const Config& config)
+  : impl_(new Impl(username, password, config))
 {
 }
 
@@ -107,21 +308,96 @@ SpotifyBackstage::~SpotifyBackstage()
 {
 }
 
+int SpotifyBackstage::getEventFd()
+{
+    return impl_->getEventFd();
+}
+
+int SpotifyBackstage::processEvents()
+{
+    return impl_->processEvents();
+}
+
+StartupTimes SpotifyBackstage::getStartupTimes()
+{
+    return impl_->getStartupTimes();
+}
+
+RealtimeStatus SpotifyBackstage::getRealtimeStatus()
+{
+    return impl_->getRealtimeStatus();
+}
+
 EqState SpotifyBackstage::getEqState()
 {
     return impl_->getEqState();
 }
 
+int SpotifyBackstage::subscribe(const EventCallback& callback)
+{
+    return impl_->subscribe(callback);
+}
+
+void SpotifyBackstage::unsubscribe(int id)
+{
+    impl_->unsubscribe(id);
+}
+
 std::vector<Track> SpotifyBackstage::getPlayQueue()
 {
     return impl_->getPlayQueue();
 }
 
+std::future<std::vector<Track>> SpotifyBackstage::getPlayQueueAsync()
+{
+    return impl_->getPlayQueueAsync();
+}
+
+void SpotifyBackstage::getPlayQueueAsync(const TracksCallback& callback)
+{
+    impl_->getPlayQueueAsync(callback);
+}
+
+std::shared_ptr<const PlayQueueSnapshot> SpotifyBackstage::getPlayQueueSnapshot()
+{
+    return impl_->getPlayQueueSnapshot();
+}
+
 void SpotifyBackstage::enqueue(const std::string& uri)
 {
     impl_->enqueue(uri);
 }
 
+void SpotifyBackstage::enqueue(const std::vector<std::string>& uris)
+{
+    impl_->enqueue(uris);
+}
+
+void SpotifyBackstage::setTracksLoadedCallback(const TracksCallback& callback)
+{
+    impl_->setTracksLoadedCallback(callback);
+}
+
+void SpotifyBackstage::insert(int index, const std::string& uri)
+{
+    impl_->insert(index, uri);
+}
+
+void SpotifyBackstage::remove(int index)
+{
+    impl_->remove(index);
+}
+
+void SpotifyBackstage::move(int from, int to)
+{
+    impl_->move(from, to);
+}
+
+void SpotifyBackstage::shuffle()
+{
+    impl_->shuffle();
+}
+
 void SpotifyBackstage::play()
 {
     impl_->play();
@@ -132,6 +408,26 @@ void SpotifyBackstage::stop()
     impl_->stop();
 }
 
+void SpotifyBackstage::pause()
+{
+    impl_->pause();
+}
+
+void SpotifyBackstage::resume()
+{
+    impl_->resume();
+}
+
+void SpotifyBackstage::seek(int position_ms)
+{
+    impl_->seek(position_ms);
+}
+
+std::chrono::microseconds SpotifyBackstage::getTimeToSilence()
+{
+    return impl_->getTimeToSilence();
+}
+
 void SpotifyBackstage::next()
 {
     impl_->next();
@@ -142,11 +438,28 @@ std::vector<Track> SpotifyBackstage::search(const std::string& query, int num_re
     return impl_->search(query, num_results, offset);
 }
 
+std::future<std::vector<Track>> SpotifyBackstage::searchAsync(
+    const std::string& query, int num_results, int offset)
+{
+    return impl_->searchAsync(query, num_results, offset);
+}
+
+void SpotifyBackstage::searchAsync(
+    const std::string& query, int num_results, int offset, const TracksCallback& callback)
+{
+    impl_->searchAsync(query, num_results, offset, callback);
+}
+
 void SpotifyBackstage::setEqOn(bool on)
 {
     impl_->setEqOn(on);
 }
 
+void SpotifyBackstage::setLowLatencyEq(bool on)
+{
+    impl_->setLowLatencyEq(on);
+}
+
 void SpotifyBackstage::setGain(double gain)
 {
     impl_->setGain(gain);
@@ -167,6 +480,36 @@ void SpotifyBackstage::setTreble(double treble)
     impl_->setTreble(treble);
 }
 
+void SpotifyBackstage::setGraphicEqBands(const std::vector<double>& bands)
+{
+    impl_->setGraphicEqBands(bands);
+}
+
+void SpotifyBackstage::setGraphicEqBand(int band, double level)
+{
+    impl_->setGraphicEqBand(band, level);
+}
+
+std::vector<double> SpotifyBackstage::getGraphicEqFrequencies(int num_bands)
+{
+    return GraphicEqualizer::getBandFrequencies(num_bands);
+}
+
+bool SpotifyBackstage::setRoomCorrection(const std::string& wav_path)
+{
+    return impl_->setRoomCorrection(wav_path);
+}
+
+void SpotifyBackstage::addAudioProcessor(std::shared_ptr<AudioProcessor> processor)
+{
+    impl_->addAudioProcessor(std::move(processor));
+}
+
+void SpotifyBackstage::clearAudioProcessors()
+{
+    impl_->clearAudioProcessors();
+}
+
 int SpotifyBackstage::getCurrentOutputDevice()
 {
     return impl_->getCurrentOutputDevice();
@@ -177,9 +520,65 @@ std::vector<std::pair<int, std::string>> SpotifyBackstage::getOutputDevices()
     return impl_->getOutputDevices();
 }
 
+void SpotifyBackstage::refreshOutputDevices()
+{
+    impl_->refreshOutputDevices();
+}
+
 void SpotifyBackstage::setOutputDevice(int dev)
 {
     impl_->setOutputDevice(dev);
 }
 
+int SpotifyBackstage::startNetworkStream(int port)
+{
+    return impl_->startNetworkStream(port);
+}
+
+void SpotifyBackstage::stopNetworkStream()
+{
+    impl_->stopNetworkStream();
+}
+
+long long SpotifyBackstage::getNumAudioPoolMisses()
+{
+    return impl_->getNumAudioPoolMisses();
+}
+
+long long SpotifyBackstage::getNumAudioAllocations()
+{
+    return impl_->getNumAudioAllocations();
+}
+
+void SpotifyBackstage::render(
+    const std::vector<std::string>& uris, const std::string& path, const RenderCallback& callback)
+{
+    impl_->render(uris, path, callback);
+}
+
+PlayQueueSnapshot::PlayQueueSnapshot(long long v, const std::shared_ptr<const TrackInfoList>& t)
+  : version(v), tracks_(t)
+{
+}
+
+int PlayQueueSnapshot::getNumTracks() const
+{
+    return tracks_->tracks.size();
+}
+
+Track PlayQueueSnapshot::getTrack(int index) const
+{
+    return tracks_->tracks.at(index).toTrack();
+}
+
+std::vector<Track> PlayQueueSnapshot::getTracks() const
+{
+    std::vector<Track> tracks;
+    tracks.reserve(tracks_->tracks.size());
+    for (const auto& info : tracks_->tracks)
+        tracks.push_back(info.toTrack());
+
+    return tracks;
+}
+
 }
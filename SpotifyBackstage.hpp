@@ -1,6 +1,10 @@
 #ifndef SPOTIFY_BACKSTAGE_SPOTIFYBACKSTAGE_HPP
 #define SPOTIFY_BACKSTAGE_SPOTIFYBACKSTAGE_HPP
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
 #include <memory>
 #include <string>
 #include <utility>
@@ -9,8 +13,27 @@
 namespace spotify_backstage
 {
 
+class AudioProcessor;
 struct EqState;
+struct Event;
+struct PlayQueueSnapshot;
+struct RealtimeStatus;
+struct RenderProgress;
+struct StartupTimes;
 struct Track;
+struct TrackInfoList;
+
+/** Callback type for reporting the progress of SpotifyBackstage::render */
+typedef std::function<void(const RenderProgress&)> RenderCallback;
+
+/** Callback type for receiving the results of the asynchronous queries */
+typedef std::function<void(const std::vector<Track>&)> TracksCallback;
+
+/** Callback type for receiving events */
+typedef std::function<void(const Event&)> EventCallback;
+
+/** Callback type for receiving the credentials blob */
+typedef std::function<void(const std::string&)> CredentialsCallback;
 
 /**
  * SpotifyBackstage implements the API to spotify-backstage library.
@@ -18,14 +41,31 @@ struct Track;
  * The API is used by creating a SpotifyBackstage instance.
  * 
  * Features:
- * - Play queue: Enqueue tracks to the play queue. spotify-backstage will play them in the order they were added.
- * - Search: Search tracks from Spotify catalog.
- * - Equalizer: Simple three channel equalizer.
- * - Output device selection: Ability to select the output device for the audio.
+ * - Play queue: Enqueue tracks, albums or playlists to the play queue. spotify-backstage will play them in the order
+ *   they were added.
+ *   Tracks can also be inserted, removed and moved anywhere in the queue, and the queue can be shuffled.
+ * - Playback control: Pause, resume and seek within the playing track.
+ * - Search: Search tracks from Spotify catalog. Searches can also be run without blocking, with future or callback.
+ *   SearchCursor pages through the results, fetching the next page in the background.
+ * - Equalizer: Simple three channel equalizer, or ISO 10/31-band graphic equalizer.
+ * - Room correction: Long FIR filter loaded from a WAV file.
+ * - Audio processors: Insert own processing, e.g. gain, limiting or level metering, on the audio path.
+ * - Output device selection: Ability to select the output device for the audio. The device list is cached and can
+ *   be refreshed.
+ * - Network streaming: Serve the equalized audio to any number of clients over HTTP.
+ * - Rendering: Render equalized tracks to a WAV file faster than real time.
+ * - Events: Subscribe to events, e.g. track changes, instead of polling.
+ * - Embedding: Run the Spotify session on the caller's event loop instead of a dedicated thread.
+ * - Persistent cache: Serve restarts and replays from disk, and log in without the password.
+ * - State restore: Save the play queue, playback position and equalizer, and continue from them after a restart.
+ * - Real time setup: Run the audio and session threads with real time scheduling or pinned to CPUs, and lock the
+ *   memory, with a report of what was applied.
  */
 class SpotifyBackstage
 {
 public:
+    struct Config;
+
     /**
      * Ctor.
      * 
@@ -34,21 +74,150 @@ public:
      */
     SpotifyBackstage(const std::string& username, const std::string& password);
 
+    /**
+     * Ctor.
+     * 
+     * @param username Spotify username
+     * @param password Password for username. Can be left empty when logging in with a credentials blob or as the
+     *                 remembered user (see Config).
+     * @param config Options for running spotify-backstage
+     */
+    SpotifyBackstage(const std::string& username, const std::string& password, const Config& config);
+
     ~SpotifyBackstage();
 
+    /**
+     * Get the file descriptor to add to the caller's event loop in the embedded mode (see Config::embedded).
+     * The fd becomes readable when processEvents() needs to be called.
+     * 
+     * @return The fd, or -1 if not in the embedded mode.
+     */
+    int getEventFd();
+
+    /**
+     * Process the Spotify events and the calls made to SpotifyBackstage in the embedded mode
+     * (see Config::embedded). Call this when the fd returned by getEventFd() is readable, or when the time returned
+     * by the previous call has passed, whichever comes first.
+     * 
+     * @return Time in milliseconds until this needs to be called again, if the fd doesn't become readable before.
+     *         -1 if not in the embedded mode. Nothing is done then.
+     */
+    int processEvents();
+
+    /**
+     * Get the times the startup phases took. The audio device is initialized in the background in parallel with
+     * the Spotify login, so the constructor doesn't wait for either.
+     */
+    StartupTimes getStartupTimes();
+
+    /**
+     * Get what was applied of the thread scheduling, CPU affinity and memory locking settings of Config.
+     * The settings can fail e.g. for lack of privileges (CAP_SYS_NICE, RLIMIT_RTPRIO, RLIMIT_MEMLOCK).
+     */
+    RealtimeStatus getRealtimeStatus();
+
     /** Get the current state of the equalizer */
     EqState getEqState();
 
+    /**
+     * Subscribe to events. The events are delivered in order from a dedicated thread, so the callback doesn't hold up
+     * playback. If the subscribers fall far behind, events are dropped.
+     * 
+     * @param callback Called with each event. The callback may call any SpotifyBackstage method.
+     * @return Subscription ID to pass to unsubscribe().
+     */
+    int subscribe(const EventCallback& callback);
+
+    /**
+     * Cancel a subscription. The callback may still be called once if an event is being delivered at the same time.
+     * 
+     * @param id Subscription ID returned by subscribe().
+     */
+    void unsubscribe(int id);
+
     /** Get the current play queue */
     std::vector<Track> getPlayQueue();
 
+    /** Get the current play queue without blocking. The returned future becomes ready when the queue is available. */
+    std::future<std::vector<Track>> getPlayQueueAsync();
+
     /**
-     * Enqueue a track to the play queue.
+     * Get the current play queue without blocking.
      * 
-     * @param uri Spotify URI of the track to enqueue.
+     * @param callback Called with the play queue. The callback is called from an internal thread.
+     *                 It must not call the blocking getPlayQueue() or search().
+     */
+    void getPlayQueueAsync(const TracksCallback& callback);
+
+    /**
+     * Get an immutable snapshot of the current play queue.
+     * The snapshot is shared between the callers for as long as the play queue doesn't change,
+     * so polling this is cheap even with a long play queue. Compare the versions of two snapshots
+     * to see if the play queue has changed between them.
+     */
+    std::shared_ptr<const PlayQueueSnapshot> getPlayQueueSnapshot();
+
+    /**
+     * Set callback for track metadata arriving.
+     * The metadata of a track may not have loaded yet when it's added to the play queue. Its artist, album and name
+     * are empty then. When the metadata of such tracks loads, the callback is called with the loaded tracks,
+     * and the play queue version changes, so there's no need to poll for the metadata.
+     * Search results are returned only after their metadata has loaded.
+     * 
+     * @param callback Called with the tracks whose metadata loaded. The callback is called from an internal thread.
+     *                 It must not call the blocking getPlayQueue() or search().
+     */
+    void setTracksLoadedCallback(const TracksCallback& callback);
+
+    /**
+     * Enqueue a track, album or playlist to the play queue.
+     * Albums and playlists are enqueued as their tracks, once they have loaded.
+     * 
+     * @param uri Spotify URI of the track, album or playlist to enqueue.
      */
     void enqueue(const std::string& uri);
 
+    /**
+     * Enqueue many tracks, albums or playlists to the play queue at once.
+     * The tracks are added to the play queue in the order of uris. Albums and playlists are expanded to their tracks
+     * in the background, and any tracks after them wait until they have loaded.
+     * 
+     * @param uris Spotify URIs of the tracks, albums or playlists to enqueue.
+     */
+    void enqueue(const std::vector<std::string>& uris);
+
+    /**
+     * Insert a track to the play queue.
+     * The track at the head of the play queue (index 0) is the one playing. If the track is inserted at the head
+     * during playback, it starts playing. Takes O(log n) time, where n is the length of the play queue.
+     * 
+     * @param index Index in the play queue where the track is inserted, 0 - length of the play queue.
+     * @param uri Spotify URI of the track to insert.
+     */
+    void insert(int index, const std::string& uri);
+
+    /**
+     * Remove a track from the play queue.
+     * If the track at the head is removed during playback, the next track starts playing.
+     * Takes O(log n) time, where n is the length of the play queue.
+     * 
+     * @param index Index of the track to remove.
+     */
+    void remove(int index);
+
+    /**
+     * Move a track to another position in the play queue.
+     * If the track at the head changes during playback, the new head starts playing.
+     * Takes O(log n) time, where n is the length of the play queue.
+     * 
+     * @param from Index of the track to move.
+     * @param to Index where the track is moved.
+     */
+    void move(int from, int to);
+
+    /** Shuffle the play queue. The track at the head stays in place, since it may be playing. */
+    void shuffle();
+
     /**
      * Start playback. The track currently at the head of the play queue will start playing.
      * Once the track is finished, it's removed from the play queue and the next track in the queue is played.
@@ -59,6 +228,30 @@ public:
     /** Stop playback. */
     void stop();
 
+    /**
+     * Pause playback. The output stops once the audio already passed to the audio device has been played, which
+     * takes the device's latency. The audio buffered before the device is kept, so resume() continues from there
+     * without losing or repeating any audio. Ignored if nothing is playing.
+     */
+    void pause();
+
+    /** Resume paused playback. Calling play() while paused also resumes. */
+    void resume();
+
+    /**
+     * Seek within the playing track. The audio buffered from the old position is dropped, and the output restarts
+     * with a shorter prebuffer than normally, so the new position is heard quickly. Ignored if nothing is playing.
+     * 
+     * @param position_ms Position from the start of the track, in milliseconds.
+     */
+    void seek(int position_ms);
+
+    /**
+     * Get the time to silence of the latest stop, measured from the stop() or next() call to the moment the
+     * audio output was stopped. Audio still waiting to be processed is dropped when playback stops.
+     */
+    std::chrono::microseconds getTimeToSilence();
+
     /**
      * Stop the playback, remove the track currently at the head of the play queue from the queue,
      * and start playing the next track in the queue (if the queue is not empty).
@@ -82,6 +275,21 @@ public:
      */
     std::vector<Track> search(const std::string& query, int num_results, int offset);
 
+    /**
+     * Search tracks from the Spotify catalog without blocking. Any number of searches can be in progress at once.
+     * The parameters are the same as with search(). The returned future becomes ready when the results arrive.
+     */
+    std::future<std::vector<Track>> searchAsync(const std::string& query, int num_results, int offset);
+
+    /**
+     * Search tracks from the Spotify catalog without blocking. Any number of searches can be in progress at once.
+     * The parameters are the same as with search().
+     * 
+     * @param callback Called with the results. The callback is called from an internal thread.
+     *                 It must not call the blocking getPlayQueue() or search().
+     */
+    void searchAsync(const std::string& query, int num_results, int offset, const TracksCallback& callback);
+
     /**
      * Set equalizer on/off.
      * 
@@ -89,6 +297,19 @@ public:
      */
     void setEqOn(bool on);
 
+    /**
+     * Set low latency equalizer mode on/off.
+     * Normally the equalizer is applied before the audio goes to the output buffer, so the changes in the
+     * equalizer settings are heard only after the buffered audio (up to ~0.7 s) has been played.
+     * In the low latency mode the equalizer is applied on the output side of the buffer, just before the
+     * audio goes to the device, so the changes are heard within one device period.
+     * The audio already in the buffer when the mode is switched is played as it was processed. If the mode is
+     * switched again before that audio has been played, the new switch is made after it.
+     * 
+     * @param on true = on, false = off.
+     */
+    void setLowLatencyEq(bool on);
+
     /**
      * Set equalizer gain.
      * 
@@ -117,6 +338,63 @@ public:
      */
     void setTreble(double treble);
 
+    /**
+     * Switch to the graphic equalizer and set its band levels.
+     * The graphic equalizer replaces the bass, mid and treble channels. The gain and the on/off
+     * setting apply to both equalizers.
+     * 
+     * @param bands The level of each band, 1.0 = 100%. The number of levels selects the equalizer:
+     *              10 = ISO octave bands, 31 = ISO third octave bands, empty = back to the three channel equalizer.
+     *              The center frequencies of the bands are given by getGraphicEqFrequencies.
+     */
+    void setGraphicEqBands(const std::vector<double>& bands);
+
+    /**
+     * Set the level of one graphic equalizer band.
+     * Has no effect unless the graphic equalizer has been selected with setGraphicEqBands.
+     * 
+     * @param band Index of the band.
+     * @param level The level. 1.0 = 100%.
+     */
+    void setGraphicEqBand(int band, double level);
+
+    /**
+     * Get the center frequencies (Hz) of the graphic equalizer bands.
+     * 
+     * @param num_bands 10 or 31.
+     */
+    static std::vector<double> getGraphicEqFrequencies(int num_bands);
+
+    /**
+     * Set the room correction filter. The filter is applied to the audio after the equalizer,
+     * regardless of whether the equalizer is on. It adds a latency of 512 frames.
+     * 
+     * @param wav_path Path of a WAV file containing the impulse response of the filter. The response can be
+     *                 mono, or have one channel per audio channel. Its sample rate must match the audio
+     *                 (44.1 kHz for Spotify), otherwise the filter is bypassed. Empty path removes the filter.
+     * @return false if the file couldn't be read.
+     */
+    bool setRoomCorrection(const std::string& wav_path);
+
+    /**
+     * Add a processor to the audio path. The processors are run after the equalizer and the room correction,
+     * in the order they were added, and their output goes to the device and the network stream.
+     * In the low latency equalizer mode (see setLowLatencyEq()), the equalizer is applied to the audio going to the
+     * device only after the output buffer, so the processors see the audio before the equalizer then.
+     * The rendering doesn't use them.
+     * 
+     * @param processor The processor. It's run in the audio thread from now on, so its parameters must only be
+     *                  changed in a thread safe way. The audio path shares the ownership: the caller can keep
+     *                  a reference to control the processor, and it stays valid after clearAudioProcessors().
+     */
+    void addAudioProcessor(std::shared_ptr<AudioProcessor> processor);
+
+    /**
+     * Remove all the processors added with addAudioProcessor(). The audio path drops its references to them in the
+     * audio thread, between two blocks, so a processor may still process a block after this returns.
+     */
+    void clearAudioProcessors();
+
     /** Get the index of the currently selected audio output device. */
     int getCurrentOutputDevice();
 
@@ -126,6 +404,13 @@ public:
      */
     std::vector<std::pair<int, std::string>> getOutputDevices();
 
+    /**
+     * Enumerate the audio output devices again, e.g. after plugging in a device. getOutputDevices() returns the
+     * devices found at startup or on the latest refresh. The current device is kept if it's still available,
+     * but its index may change. Playback is interrupted for the time of the refresh.
+     */
+    void refreshOutputDevices();
+
     /**
      * Set the audio output device.
      * 
@@ -133,19 +418,208 @@ public:
      */
     void setOutputDevice(int dev);
 
+    /**
+     * Start serving the equalized audio stream over HTTP.
+     * The stream is raw 16-bit PCM (Content-Type audio/L16) and can be played with e.g.
+     * "ffplay -f s16be -ar 44100 -ac 2 http://host:port/". The stream follows what is played on the
+     * output device. If the stream format changes, the connected clients are disconnected.
+     * Calling this again replaces the previous stream.
+     * 
+     * @param port TCP port to listen to. 0 = let the system pick a free port.
+     * @return The port listened to, or -1 if the socket couldn't be opened.
+     */
+    int startNetworkStream(int port);
+
+    /** Stop serving the network stream and disconnect all clients. */
+    void stopNetworkStream();
+
+    /**
+     * Get the number of audio block pool misses. The audio passed from libspotify through the equalizer to the
+     * output device and the network stream is kept in blocks preallocated in pools. A miss is a block allocated
+     * from the heap because a pool ran out, or the audio didn't fit in a pooled block. During normal playback this
+     * stays at zero. Only the blocks are counted, not the other allocations on the audio path.
+     * getNumAudioAllocations() counts them all.
+     */
+    long long getNumAudioPoolMisses();
+
+    /**
+     * Get the number of heap allocations made on the audio path: in libspotify's music delivery callback, while
+     * the sound thread processes and buffers the audio, in the audio driver callback and while the network stream
+     * takes in the audio. This includes the audio block pool misses, the message channel overflows and the filter
+     * setups after a format change. During normal playback this stays constant.
+     * Counting replaces the global operator new, so it's only built in with the CMake option
+     * COUNT_AUDIO_ALLOCATIONS, meant for debug builds.
+     *
+     * @return The number of allocations, or -1 if counting isn't built in.
+     */
+    long long getNumAudioAllocations();
+
+    /**
+     * Render tracks to a WAV file with the current equalizer settings applied.
+     * The rendering isn't paced to real time, it runs as fast as the tracks can be decoded and equalized.
+     * Playback is stopped when the rendering starts, and play(), stop(), pause(), seek() and next() are ignored until
+     * the rendering is finished.
+     * 
+     * @param uris Spotify URIs of the tracks to render. The tracks are rendered one after another to the same file.
+     * @param path Path of the WAV file to write.
+     * @param callback Called with the progress of the rendering, about once per second of rendered audio and
+     *                 when the rendering is finished. The callback is called from an internal thread.
+     */
+    void render(const std::vector<std::string>& uris, const std::string& path, const RenderCallback& callback);
+
 private:
     class Impl;
     std::unique_ptr<Impl> impl_;
 };
 
+/**
+ * ThreadConfig holds the scheduling and CPU affinity settings of a thread (see SpotifyBackstage::Config).
+ * The defaults leave the thread as it is.
+ */
+struct ThreadConfig
+{
+    enum Policy
+    {
+        /** Normal time sharing scheduling */
+        DEFAULT,
+
+        /** Real time SCHED_FIFO scheduling */
+        FIFO,
+
+        /** Real time SCHED_RR scheduling */
+        ROUND_ROBIN
+    };
+
+    ThreadConfig() : policy(DEFAULT), priority(0), nice(0), cpus()
+    {
+    }
+
+    /** Scheduling policy */
+    Policy policy;
+
+    /** Real time priority with FIFO and ROUND_ROBIN, 1-99 on Linux */
+    int priority;
+
+    /** Nice value with DEFAULT policy, -20-19. 0 = not changed. */
+    int nice;
+
+    /** CPUs to pin the thread to. Empty = not pinned. */
+    std::vector<int> cpus;
+};
+
+/**
+ * Config holds the options for running spotify-backstage.
+ */
+struct SpotifyBackstage::Config
+{
+    Config()
+      : embedded(false), cache_location(), cache_size_mb(0), remember_me(false), credentials_blob(),
+        credentials_callback(), state_path(), state_save_interval_ms(5000), audio_thread(), session_thread(),
+        lock_memory(false)
+    {
+    }
+
+    /**
+     * Run the Spotify session on the caller's event loop instead of a dedicated thread.
+     * The caller adds the fd from getEventFd() to its loop, and calls processEvents() when it's readable or when the
+     * time returned by the previous processEvents() has passed. The loop only wakes up when there are calls to
+     * handle or when libspotify asks for it.
+     * processEvents() and the destructor must be called from the same thread, and the blocking calls, such as
+     * search(), getPlayQueue() and SearchCursor, must not be used from that thread. The embedded mode is only
+     * available on Linux.
+     */
+    bool embedded;
+
+    /**
+     * Directory for libspotify's cache and settings. With the cache, the metadata and the audio played before are
+     * read from disk instead of the network. Empty = no cache.
+     */
+    std::string cache_location;
+
+    /** Max size of the cache in megabytes. 0 = let libspotify decide (10% of the free disk space). */
+    int cache_size_mb;
+
+    /**
+     * Let libspotify remember the user in cache_location. On the next start, if the password and credentials_blob
+     * are empty, the remembered user is logged in.
+     */
+    bool remember_me;
+
+    /**
+     * Credentials blob from a previous login, received with credentials_callback. If given, it's used to log in
+     * instead of the password. If the login with the blob fails, the password is tried.
+     */
+    std::string credentials_blob;
+
+    /**
+     * Called with a new credentials blob after logging in. The blob can be stored and given in credentials_blob
+     * on the next start, instead of storing the password. Called from an internal thread.
+     */
+    CredentialsCallback credentials_callback;
+
+    /**
+     * File to save the playback state to: the play queue, the position in the current track and the equalizer
+     * settings. The state is saved periodically and when SpotifyBackstage is destroyed, and restored on the next
+     * start: the equalizer right away, and the play queue in one go after the login. If the playback was on, it
+     * continues from the saved position. The periodic saves aren't synced to the disk, so a system crash may lose
+     * the latest one, but the file is never left partial. Empty = the state isn't saved.
+     */
+    std::string state_path;
+
+    /** How often the playback state is saved, in milliseconds. The file is only written when the state has changed. */
+    int state_save_interval_ms;
+
+    /**
+     * Scheduling and CPU affinity of the audio thread, which equalizes the audio and feeds it to the output.
+     * With real time scheduling, it isn't preempted by the other work on a busy host, and the output doesn't run dry.
+     * The threads equalizing many-channel audio in parallel for the audio thread get the same settings.
+     */
+    ThreadConfig audio_thread;
+
+    /** Scheduling and CPU affinity of the Spotify session thread. Not used in the embedded mode. */
+    ThreadConfig session_thread;
+
+    /**
+     * Lock the audio output buffer and the audio block pool in memory, so that the audio path never waits for them
+     * to be swapped in. Only these regions are locked, about 256 kB, not the whole process. The locked memory
+     * counts against RLIMIT_MEMLOCK, so the limit must allow that much, or the process needs CAP_IPC_LOCK.
+     */
+    bool lock_memory;
+};
+
+/**
+ * AudioProcessor processes the audio on its way to the output (see SpotifyBackstage::addAudioProcessor).
+ * The audio comes in blocks, so the cost of the virtual call is paid once per block, not per sample.
+ * Several processing stages can be fused into one processor with SampleChain (ProcessorChain.hpp).
+ */
+class AudioProcessor
+{
+public:
+    virtual ~AudioProcessor() {}
+
+    /**
+     * Process a block of audio in place. Called from the audio thread, so it must not block.
+     * 
+     * @param data Interleaved 16-bit samples
+     * @param num_samples Number of samples in data, over all channels
+     * @param num_channels Number of channels
+     * @param sample_rate Sample rate
+     */
+    virtual void process(int16_t* data, int num_samples, int num_channels, int sample_rate) = 0;
+
+    /** Clear the state kept between the blocks. Called when the playback is stopped or seeks. */
+    virtual void reset() {}
+};
+
 /**
  * EqState encapsulates the state of the equalizer.
  * With the gain and the channel levels, value 1.0 = 100%.
  */
 struct EqState
 {
-    EqState(bool on, double g, double b, double m, double t)
-      : is_on(on), gain(g), bass(b), mid(m), treble(t)
+    EqState(bool on, double g, double b, double m, double t, bool ll = false,
+        const std::vector<double>& bnds = std::vector<double>())
+      : is_on(on), gain(g), bass(b), mid(m), treble(t), low_latency(ll), bands(bnds)
     {
     }
 
@@ -163,6 +637,131 @@ struct EqState
     
     /** Treble channel level */
     double treble;
+
+    /** Is the low latency mode on? */
+    bool low_latency;
+
+    /** Graphic equalizer band levels. Empty if the three channel equalizer is used. */
+    std::vector<double> bands;
+};
+
+/**
+ * SearchCursor pages through the results of a Spotify search.
+ * The page after the current one is fetched in the background, so moving to it doesn't wait on the network.
+ * The fetched pages are kept, so moving back doesn't wait either.
+ * 
+ * SearchCursor is meant to be used from one thread. It must not outlive the SpotifyBackstage it was created with,
+ * and it must not be used from the callbacks of the asynchronous SpotifyBackstage methods.
+ */
+class SearchCursor
+{
+public:
+    /**
+     * Ctor. Starts fetching the first two pages.
+     * 
+     * @param backstage SpotifyBackstage to search with.
+     * @param query Search query string.
+     * @param page_size Number of tracks per page.
+     */
+    SearchCursor(SpotifyBackstage& backstage, const std::string& query, int page_size);
+
+    ~SearchCursor();
+
+    /** Get the index of the current page. The first page is 0. */
+    int getPageIndex() const;
+
+    /** Is the current page fetched? If so, getPage() doesn't block. */
+    bool isPageReady() const;
+
+    /** Get the tracks on the current page. Blocks until the page has been fetched. */
+    std::vector<Track> getPage();
+
+    /**
+     * Move to the next page, and start fetching the page after it.
+     * Blocks if the next page is still being fetched.
+     * 
+     * @return false if there are no more results. The cursor stays on the current page then.
+     */
+    bool next();
+
+    /**
+     * Move to the previous page.
+     * 
+     * @return false if the cursor is on the first page.
+     */
+    bool previous();
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+/**
+ * Event tells about something that happened in spotify-backstage. See SpotifyBackstage::subscribe.
+ */
+struct Event
+{
+    /** Event types */
+    enum Type
+    {
+        /** A track started playing. */
+        TRACK_STARTED,
+
+        /** A track played to the end. */
+        TRACK_ENDED,
+
+        /** The play queue changed. value is the new play queue version, see PlayQueueSnapshot. */
+        QUEUE_CHANGED,
+
+        /** The audio output ran out of data. value is the total number of underruns. */
+        UNDERRUN,
+
+        /** The output device changed. value is the index of the new device. */
+        DEVICE_CHANGED,
+
+        /** A search completed. value is the number of tracks found. */
+        SEARCH_COMPLETED
+    };
+
+    Event() : type(TRACK_STARTED), value(0)
+    {
+    }
+
+    Event(Type t, long long v) : type(t), value(v)
+    {
+    }
+
+    /** Event type */
+    Type type;
+
+    /** Event data. Its meaning depends on type. */
+    long long value;
+};
+
+/**
+ * RenderProgress tells how far SpotifyBackstage::render has progressed.
+ */
+struct RenderProgress
+{
+    RenderProgress(int index, int num, double p, bool fin, bool ok)
+      : track_index(index), num_tracks(num), progress(p), finished(fin), succeeded(ok)
+    {
+    }
+
+    /** Index of the track being rendered */
+    int track_index;
+
+    /** Number of tracks to render */
+    int num_tracks;
+
+    /** Progress of the whole rendering. 1.0 = 100%. */
+    double progress;
+
+    /** Is the rendering finished? */
+    bool finished;
+
+    /** Was the rendering successful? Only valid when finished is true. */
+    bool succeeded;
 };
 
 /**
@@ -192,6 +791,103 @@ struct Track
     std::string uri;
 };
 
+/**
+ * PlayQueueSnapshot is the state of the play queue at one point in time.
+ * The metadata strings of the tracks are interned: an artist or album name repeating across the play queue and
+ * the search results is stored once, and the snapshots share it with the play queue. Track objects are built
+ * only when asked for.
+ */
+struct PlayQueueSnapshot
+{
+    PlayQueueSnapshot(long long v, const std::shared_ptr<const TrackInfoList>& t);
+
+    /** Version of the play queue. The version changes every time the play queue changes. */
+    long long version;
+
+    /** Get the number of tracks in the play queue. */
+    int getNumTracks() const;
+
+    /**
+     * Get a track in the play queue.
+     *
+     * @param index Index of the track, 0 = the playing track.
+     */
+    Track getTrack(int index) const;
+
+    /** Get all the tracks in the play queue. */
+    std::vector<Track> getTracks() const;
+
+private:
+    std::shared_ptr<const TrackInfoList> tracks_;
+};
+
+/**
+ * StartupTimes holds the times it took to reach the startup phases, measured from the start of the
+ * SpotifyBackstage constructor. The phases run in parallel. A phase not reached yet has time -1.
+ */
+struct StartupTimes
+{
+    StartupTimes() : constructed(-1), audio_initialized(-1), logged_in(-1), first_audio(-1)
+    {
+    }
+
+    /** SpotifyBackstage constructor returned */
+    std::chrono::microseconds constructed;
+
+    /** Audio device initialized and the output stream opened */
+    std::chrono::microseconds audio_initialized;
+
+    /** Logged in to Spotify */
+    std::chrono::microseconds logged_in;
+
+    /** First audio written to the output device */
+    std::chrono::microseconds first_audio;
+};
+
+/**
+ * ThreadStatus tells what was applied of a thread's ThreadConfig.
+ */
+struct ThreadStatus
+{
+    ThreadStatus() : started(false), scheduling(false), affinity(false), error()
+    {
+    }
+
+    /** The thread has started and the settings have been applied to it */
+    bool started;
+
+    /** The requested policy and priority, or the nice value, are in effect. False if none was requested. */
+    bool scheduling;
+
+    /** The thread is pinned to the requested CPUs. False if none were requested. */
+    bool affinity;
+
+    /** Why the settings that failed couldn't be applied. Empty if all were. */
+    std::string error;
+};
+
+/**
+ * RealtimeStatus tells what was applied of the thread and memory settings of SpotifyBackstage::Config.
+ */
+struct RealtimeStatus
+{
+    RealtimeStatus() : audio_thread(), session_thread(), memory_locked(false), memory_error()
+    {
+    }
+
+    /** Status of the audio thread */
+    ThreadStatus audio_thread;
+
+    /** Status of the Spotify session thread. Never started in the embedded mode. */
+    ThreadStatus session_thread;
+
+    /** The audio buffers are locked in memory. False if locking wasn't requested. */
+    bool memory_locked;
+
+    /** Why the audio buffers couldn't be locked. Empty if they could, or locking wasn't requested. */
+    std::string memory_error;
+};
+
 }
 
 #endif
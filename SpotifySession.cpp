@@ -1,18 +1,35 @@
 #include "SpotifySession.hpp"
 
 #include "Appkey.hpp"
+#include "AudioAllocations.hpp"
+#include "Channel.hpp"
+#include "EventDispatcher.hpp"
+#include "IndexedList.hpp"
 #include "Logger.hpp"
+#include "PlaybackState.hpp"
+#include "RenderWriter.hpp"
+#include "SearchCache.hpp"
 #include "SoundSystem.hpp"
 #include "SpotifyBackstage.hpp"
+#include "StartupTimer.hpp"
+#include "StateWriter.hpp"
+#include "StringTable.hpp"
+#include "ThreadSetup.hpp"
+#include "Variant.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <iostream>
 #include <libspotify/api.h>
-#include <list>
 #include <map>
-#include <PolyM/Queue.hpp>
-#include <sstream>
+#include <mutex>
+#include <sys/eventfd.h>
 #include <thread>
+#include <unistd.h>
 
 // Check for Spotify errors
 #define CHECK_SP_ERR(expr)\
@@ -27,287 +44,1478 @@ namespace spotify_backstage {
 
 namespace {
 
-// Get Track object with data from sp_track and sp_link
-Track getTrack(sp_track* track, sp_link* link)
+// Number of messages the channel holds without allocating
+const int CHANNEL_SIZE = 64;
+
+// Number of search results kept in cache, and how long they're kept
+const int SEARCH_CACHE_SIZE = 128;
+const std::chrono::minutes SEARCH_CACHE_TTL(10);
+
+// How long search results are held back waiting for track metadata
+const std::chrono::seconds SEARCH_METADATA_TIMEOUT(10);
+
+// How long an album or playlist to enqueue may take to load before it's dropped
+const std::chrono::seconds ENQUEUE_LOAD_TIMEOUT(30);
+
+// Is track's metadata still loading? Tracks that failed to load count as done.
+bool isLoading(sp_track* track)
+{
+    return sp_track_error(track) == SP_ERROR_IS_LOADING;
+}
+
+// Artist names of track, separated with commas
+std::string getArtists(sp_track* track)
 {
-    std::stringstream artistbuf;
+    std::string artists;
     for (int i = 0; i < sp_track_num_artists(track); ++i)
     {
         if (i > 0)
-            artistbuf << ", ";
+            artists += ", ";
 
-        artistbuf << sp_artist_name(sp_track_artist(track, i));
+        artists += sp_artist_name(sp_track_artist(track, i));
     }
 
+    return artists;
+}
+
+// Get Track object with data from sp_track and sp_link
+Track getTrack(sp_track* track, sp_link* link)
+{
     char uri[128];
     sp_link_as_string(link, uri, 128);
 
-    return Track(artistbuf.str(), sp_album_name(sp_track_album(track)), sp_track_name(track),
+    return Track(getArtists(track), sp_album_name(sp_track_album(track)), sp_track_name(track),
         sp_track_duration(track) / 1000, uri);
 }
 
+// Get TrackInfo with data from sp_track and sp_link, with the strings interned in strings
+TrackInfo getTrackInfo(StringTable& strings, sp_track* track, sp_link* link)
+{
+    char uri[128];
+    sp_link_as_string(link, uri, 128);
+
+    return TrackInfo(strings.intern(getArtists(track)), strings.intern(sp_album_name(sp_track_album(track))),
+        strings.intern(sp_track_name(track)), sp_track_duration(track) / 1000, strings.intern(uri));
+}
+
+std::vector<Track> toTracks(const std::vector<TrackInfo>& infos)
+{
+    std::vector<Track> tracks;
+    tracks.reserve(infos.size());
+    for (const auto& info : infos)
+        tracks.push_back(info.toTrack());
+
+    return tracks;
+}
+
 }
 
 class SpotifySession::Impl
 {
 public:
-    Impl(const std::string& username, const std::string& password, SoundSystem& sounds)
+    Impl(const std::string& username, const std::string& password, SoundSystem& sounds, EventDispatcher& events,
+        StartupTimer& startup, ThreadSetup& threads, const SpotifyBackstage::Config& config)
       : username_(username),
         password_(password),
+        config_(config),
+        login_method_(0),
         sounds_(sounds),
-        msg_queue_(),
+        events_(events),
+        startup_(startup),
+        threads_(threads),
+        channel_(CHANNEL_SIZE),
+        process_requested_(false),
+        // Created readable, so that the host's loop does the first processEvents() right away
+        event_fd_(config.embedded ? eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC) : -1),
+        wake_pending_(config.embedded),
+        next_process_(),
         spotify_cb_(),
+        playlist_cb_(),
         spotify_conf_(),
         spotify_(nullptr),
+        strings_(std::make_shared<StringTable>()),
         play_queue_(),
+        queue_version_(0),
+        queue_snapshot_(),
+        playing_(false),
+        paused_(false),
+        position_base_ms_(0),
+        frames_delivered_(0),
+        delivery_rate_(0),
+        seek_epoch_(0),
+        restore_(),
+        resume_position_ms_(-1),
+        resume_paused_(false),
+        next_save_(std::chrono::steady_clock::now()),
+        state_writer_(config.state_path.empty() ? nullptr : new StateWriter(config.state_path, sounds)),
+        pending_enqueues_(),
+        enqueue_loaded_(false),
+        tracks_loading_(),
+        searches_loading_(),
+        tracks_loaded_callback_(),
         search_req_map_(),
-        thread_(&Impl::run, this)
+        searches_in_flight_(),
+        search_cache_(SEARCH_CACHE_SIZE, SEARCH_CACHE_TTL),
+        render_mutex_(),
+        render_(),
+        thread_()
     {
+        if (!config.state_path.empty())
+            loadState();
+
+        if (!config.embedded)
+            thread_ = std::thread(&Impl::run, this);
+        else if (event_fd_ < 0)
+            LOG("Couldn't create eventfd: " << std::strerror(errno));
     }
 
     ~Impl()
     {
         LOG("SpotifySession dtor");
-        msg_queue_.put(PolyM::Msg(MSG_TERMINATE));
-        thread_.join();
-        LOG("Spotify thread finished");
+
+        if (thread_.joinable())
+        {
+            send(Terminate());
+            thread_.join();
+            LOG("Spotify thread finished");
+        }
+        else
+        {
+            if (spotify_)
+                shutdown();
+
+            if (event_fd_ >= 0)
+                close(event_fd_);
+        }
+    }
+
+    int getEventFd() const
+    {
+        return event_fd_;
+    }
+
+    // Embedded mode: handle the pending messages, and process libspotify events if they're due
+    int processEvents()
+    {
+        // Only the embedded mode has the eventfd. Otherwise the session runs in its own thread.
+        if (event_fd_ < 0)
+            return -1;
+
+        if (!spotify_)
+            setupSpotify();
+
+        // Messages sent from here on wake the loop again
+        wake_pending_ = false;
+        uint64_t count = 0;
+        if (::read(event_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            LOG("Couldn't read eventfd: " << std::strerror(errno));
+
+        Dispatch dispatch{*this, true, 0};
+        Msg msg;
+        while (channel_.tryGet(msg))
+            msg.visit(dispatch);
+
+        if (std::chrono::steady_clock::now() >= next_process_)
+            handleSpotifyProcess();
+
+        saveStateIfDue();
+
+        // 0 = libspotify is already due, so the save can't shorten it
+        const auto until_next = std::chrono::duration_cast<std::chrono::milliseconds>(
+            next_process_ - std::chrono::steady_clock::now()).count();
+        const auto timeout = std::max(0, static_cast<int>(until_next));
+        const auto until_save = untilSave();
+        return until_save >= 0 ? std::min(timeout, until_save) : timeout;
+    }
+
+    std::shared_ptr<const PlayQueueSnapshot> getPlayQueueSnapshot()
+    {
+        Reply<std::shared_ptr<const PlayQueueSnapshot>> reply;
+        send(GetPlayQueueSnapshot{&reply});
+        return reply.wait();
     }
 
     std::vector<Track> getPlayQueue()
     {
-        auto response = msg_queue_.request(PolyM::Msg(MSG_GET_PLAY_QUEUE));
-        return dynamic_cast<PolyM::DataMsg<std::vector<Track>>&>(*response).getPayload();
+        Reply<std::vector<Track>> reply;
+        send(GetPlayQueue{&reply});
+        return reply.wait();
+    }
+
+    void getPlayQueueAsync(const TracksCallback& callback)
+    {
+        send(GetPlayQueueAsync{callback});
     }
 
     void enqueue(const std::string& uri)
     {
-        msg_queue_.put(PolyM::DataMsg<std::string>(MSG_ENQUEUE, uri));
+        send(Enqueue{uri});
+    }
+
+    void enqueue(const std::vector<std::string>& uris)
+    {
+        send(EnqueueMany{uris});
+    }
+
+    void setTracksLoadedCallback(const TracksCallback& callback)
+    {
+        send(SetTracksLoadedCallback{callback});
+    }
+
+    void insert(int index, const std::string& uri)
+    {
+        send(Insert{index, uri});
+    }
+
+    void remove(int index)
+    {
+        send(Remove{index});
+    }
+
+    void move(int from, int to)
+    {
+        send(Move{from, to});
+    }
+
+    void shuffle()
+    {
+        send(Shuffle());
     }
 
     void play()
     {
-        msg_queue_.put(PolyM::Msg(MSG_PLAY));
+        send(Play());
     }
 
     void stop()
     {
-        msg_queue_.put(PolyM::Msg(MSG_STOP));
+        // The request time is passed on to measure the time to silence
+        send(Stop{std::chrono::steady_clock::now()});
+    }
+
+    void pause()
+    {
+        send(Pause());
+    }
+
+    void resume()
+    {
+        send(Resume());
+    }
+
+    void seek(int position_ms)
+    {
+        send(Seek{position_ms});
     }
 
     void next()
     {
-        msg_queue_.put(PolyM::Msg(MSG_NEXT));
+        send(Next{std::chrono::steady_clock::now()});
     }
 
     std::vector<Track> search(const std::string& query, int num_results, int offset)
     {
-        if (query.empty() || num_results < 1 || offset < 0)
-        {
-            LOG("Invalid search parameters: query = " << query << ", num_results = " <<
-                num_results << ", offset = " << offset);
+        if (!isValidSearch(query, num_results, offset))
             return std::vector<Track>();
+
+        Reply<std::vector<Track>> reply;
+        send(SearchQuery(query, num_results, offset,
+            [&reply](const std::vector<Track>& tracks) { reply.set(tracks); }));
+        return reply.wait();
+    }
+
+    void searchAsync(const std::string& query, int num_results, int offset, const TracksCallback& callback)
+    {
+        if (!isValidSearch(query, num_results, offset))
+        {
+            callback(std::vector<Track>());
+            return;
         }
 
-        auto response = msg_queue_.request(
-            PolyM::DataMsg<SearchQuery>(MSG_SEARCH, query, num_results, offset));
-        return dynamic_cast<PolyM::DataMsg<std::vector<Track>>&>(*response).getPayload();
+        send(SearchQuery(query, num_results, offset, callback));
     }
 
-private:
-    // SpotifySession Msg types
-    enum MsgType
-    {
-        MSG_TERMINATE,
-        MSG_SPOTIFY_PROCESS,
-        MSG_GET_PLAY_QUEUE,
-        MSG_GET_PLAY_QUEUE_RESPONSE,
-        MSG_ENQUEUE,
-        MSG_PLAY,
-        MSG_STOP,
-        MSG_NEXT,
-        MSG_SEARCH,
-        MSG_SEARCH_RESPONSE
-    };
+    void render(const std::vector<std::string>& uris, const std::string& path, const EqState& eq_state,
+        const RenderCallback& callback)
+    {
+        send(RenderJob(uris, path, eq_state, callback));
+    }
 
-    // Data passed in search message
+private:
+    // Search message. The results are passed to the callback.
     struct SearchQuery
     {
-        SearchQuery(const std::string& query_p, int num_results_p, int offset_p)
-          : query(query_p), num_results(num_results_p), offset(offset_p)
+        SearchQuery(const std::string& query_p, int num_results_p, int offset_p, const TracksCallback& callback_p)
+          : query(query_p), num_results(num_results_p), offset(offset_p), callback(callback_p)
         {
         }
         std::string query;
         int num_results;
         int offset;
+        TracksCallback callback;
+    };
+
+    static bool isValidSearch(const std::string& query, int num_results, int offset)
+    {
+        if (query.empty() || num_results < 1 || offset < 0)
+        {
+            LOG("Invalid search parameters: query = " << query << ", num_results = " <<
+                num_results << ", offset = " << offset);
+            return false;
+        }
+
+        return true;
+    }
+
+    // Render message
+    struct RenderJob
+    {
+        RenderJob(const std::vector<std::string>& uris_p, const std::string& path_p, const EqState& eq_state_p,
+            const RenderCallback& callback_p)
+          : uris(uris_p), path(path_p), eq_state(eq_state_p), callback(callback_p)
+        {
+        }
+        std::vector<std::string> uris;
+        std::string path;
+        EqState eq_state;
+        RenderCallback callback;
+    };
+
+    // Rest of the SpotifySession messages. Requests carry a pointer to the Reply the requester waits on.
+
+    struct Terminate
+    {
+    };
+
+    // libspotify asks for its events to be processed
+    struct SpotifyProcess
+    {
+    };
+
+    struct GetPlayQueue
+    {
+        Reply<std::vector<Track>>* reply;
+    };
+
+    struct GetPlayQueueAsync
+    {
+        TracksCallback callback;
+    };
+
+    struct GetPlayQueueSnapshot
+    {
+        Reply<std::shared_ptr<const PlayQueueSnapshot>>* reply;
+    };
+
+    struct Enqueue
+    {
+        std::string uri;
+    };
+
+    struct EnqueueMany
+    {
+        std::vector<std::string> uris;
+    };
+
+    struct SetTracksLoadedCallback
+    {
+        TracksCallback callback;
+    };
+
+    struct Insert
+    {
+        int index;
+        std::string uri;
+    };
+
+    struct Remove
+    {
+        int index;
+    };
+
+    struct Move
+    {
+        int from;
+        int to;
+    };
+
+    struct Shuffle
+    {
+    };
+
+    struct Play
+    {
+    };
+
+    struct Stop
+    {
+        std::chrono::steady_clock::time_point requested;
+    };
+
+    struct Pause
+    {
+    };
+
+    struct Resume
+    {
+    };
+
+    struct Seek
+    {
+        int position_ms;
+    };
+
+    struct Next
+    {
+        std::chrono::steady_clock::time_point requested;
+    };
+
+    struct EndOfTrack
+    {
+    };
+
+    struct RenderFailed
+    {
+    };
+
+    typedef Variant<Terminate, SpotifyProcess, GetPlayQueue, GetPlayQueueAsync, GetPlayQueueSnapshot, Enqueue,
+        EnqueueMany, SetTracksLoadedCallback, Insert, Remove, Move, Shuffle, Play, Stop, Pause, Resume, Seek, Next, SearchQuery, EndOfTrack,
+        RenderJob, RenderFailed> Msg;
+
+    // Calls the handler for each message type. The handler is picked at compile time.
+    struct Dispatch
+    {
+        void operator()(Terminate&) { keep_running = false; }
+        void operator()(SpotifyProcess&) { timeout = impl.handleSpotifyProcess(); }
+        void operator()(GetPlayQueue& msg) { impl.handleGetPlayQueue(*msg.reply); }
+        void operator()(GetPlayQueueAsync& msg) { impl.handleGetPlayQueueAsync(msg.callback); }
+        void operator()(GetPlayQueueSnapshot& msg) { impl.handleGetPlayQueueSnapshot(*msg.reply); }
+        void operator()(Enqueue& msg) { impl.handleEnqueue(msg.uri); }
+        void operator()(EnqueueMany& msg) { impl.handleEnqueueMany(msg.uris); }
+        void operator()(SetTracksLoadedCallback& msg) { impl.tracks_loaded_callback_ = std::move(msg.callback); }
+        void operator()(Insert& msg) { impl.handleInsert(msg.index, msg.uri); }
+        void operator()(Remove& msg) { impl.handleRemove(msg.index); }
+        void operator()(Move& msg) { impl.handleMove(msg.from, msg.to); }
+        void operator()(Shuffle&) { impl.handleShuffle(); }
+        void operator()(Play&) { impl.handlePlay(); }
+        void operator()(Stop& msg) { impl.handleStop(msg.requested); }
+        void operator()(Pause&) { impl.handlePause(); }
+        void operator()(Resume&) { impl.handleResume(); }
+        void operator()(Seek& msg) { impl.handleSeek(msg.position_ms); }
+        void operator()(Next& msg) { impl.handleNext(msg.requested); }
+        void operator()(SearchQuery& msg) { impl.handleSearch(msg); }
+        void operator()(EndOfTrack&) { impl.handleEndOfTrack(); }
+        void operator()(RenderJob& msg) { impl.handleRender(msg); }
+        void operator()(RenderFailed&) { impl.handleRenderFailed(); }
+
+        Impl& impl;
+        bool keep_running;
+        // Time until libspotify wants its events processed next, in ms (0 = no need)
+        int timeout;
+    };
+
+    // State of an ongoing render.
+    // The fields up to index are used in the message processing thread,
+    // the rest in libspotify thread, protected by render_mutex_.
+    struct Render
+    {
+        Render(const RenderJob& job)
+          : links(), callback(job.callback), index(0), loading(false), writer(job.path, job.eq_state), failed(false),
+            track_duration_ms(0), frames_rendered(0), frames_reported(0)
+        {
+        }
+
+        ~Render()
+        {
+            for (auto link : links)
+                sp_link_release(link);
+        }
+
+        double getProgress(int sample_rate) const
+        {
+            const auto track_frames = static_cast<double>(track_duration_ms) * sample_rate / 1000;
+            const auto track_progress = track_frames > 0 ? std::min(1.0, frames_rendered / track_frames) : 0.0;
+            return (index + track_progress) / links.size();
+        }
+
+        std::vector<sp_link*> links;
+        RenderCallback callback;
+        int index;
+        // Waiting for the track to load before it can be played
+        bool loading;
+
+        RenderWriter writer;
+        bool failed;
+        int track_duration_ms;
+        long long frames_rendered;
+        long long frames_reported;
     };
 
     void run()
     {
+        threads_.apply(ThreadSetup::SESSION);
         setupSpotify();
 
-        auto keepRunning = true;
-        auto msgReceiveTimeout = 0;
-        while (keepRunning)
+        Dispatch dispatch{*this, true, 0};
+        Msg msg;
+        while (dispatch.keep_running)
+        {
+            if (channel_.get(msg, waitTimeout(dispatch.timeout)))
+                msg.visit(dispatch);
+            else
+                dispatch.timeout = handleSpotifyProcess();
+
+            saveStateIfDue();
+        }
+
+        shutdown();
+    }
+
+    // Put message to the channel. In the embedded mode, wake up the host's loop if it isn't already.
+    void send(Msg&& msg)
+    {
+        channel_.put(std::move(msg));
+
+        if (event_fd_ >= 0 && !wake_pending_.exchange(true))
+        {
+            const uint64_t one = 1;
+            if (::write(event_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+                LOG("Couldn't wake event loop: " << std::strerror(errno));
+        }
+    }
+
+    void shutdown()
+    {
+        if (render_)
+            finishRender(false);
+
+        if (state_writer_)
+            saveState(true);
+
+        for (const auto& item : pending_enqueues_)
+            item.release(&playlist_cb_, this);
+        pending_enqueues_.clear();
+
+        for (auto track : tracks_loading_)
+            sp_track_release(track);
+        tracks_loading_.clear();
+        searches_loading_.clear();
+
+        // Don't leave anyone waiting for search results
+        for (auto& req : search_req_map_)
+        {
+            for (const auto& callback : req.second.callbacks)
+                callback(std::vector<Track>());
+            sp_search_release(req.first);
+        }
+        search_req_map_.clear();
+        searches_in_flight_.clear();
+
+        shutdownSpotify();
+    }
+
+    void setupSpotify()
+    {
+        // set up session callbacks
+        std::memset(&spotify_cb_, 0, sizeof(spotify_cb_));
+        spotify_cb_.logged_in = &loggedInCallback;
+        spotify_cb_.credentials_blob_updated = &credentialsBlobUpdatedCallback;
+        spotify_cb_.notify_main_thread = &notifyMainCallback;
+        spotify_cb_.music_delivery = &musicDeliveryCallback;
+        spotify_cb_.end_of_track = &endOfTrackCallback;
+
+        std::memset(&playlist_cb_, 0, sizeof(playlist_cb_));
+        playlist_cb_.playlist_state_changed = &playlistStateChangedCallback;
+
+        // set up session conf
+        std::memset(&spotify_conf_, 0, sizeof(spotify_conf_));
+        spotify_conf_.api_version = SPOTIFY_API_VERSION;
+        // libspotify keeps the remembered credentials in the settings, so they go to the same place as the cache
+        spotify_conf_.cache_location = config_.cache_location.c_str();
+        spotify_conf_.settings_location = config_.cache_location.c_str();
+        spotify_conf_.application_key = spotify_appkey;
+        spotify_conf_.application_key_size = sizeof(spotify_appkey);
+        spotify_conf_.user_agent = "spotify-backstage";
+        spotify_conf_.callbacks = &spotify_cb_;
+        spotify_conf_.userdata = this; // get reference to this in static callbacks
+
+        sp_session_create(&spotify_conf_, &spotify_);
+
+        if (!config_.cache_location.empty())
+            sp_session_set_cache_size(spotify_, config_.cache_size_mb);
+
+        if (!login())
+            LOG("No credentials to log in with");
+
+        LOG("Spotify session created");
+    }
+
+    // Ways to log in, in the order they're tried
+    enum LoginMethod
+    {
+        LOGIN_BLOB,
+        LOGIN_PASSWORD,
+        LOGIN_REMEMBERED,
+        NUM_LOGIN_METHODS
+    };
+
+    // Try the next way to log in. Returns false if there's none left.
+    bool login()
+    {
+        while (login_method_ < NUM_LOGIN_METHODS)
+        {
+            switch (login_method_++)
+            {
+            case LOGIN_BLOB:
+                if (!config_.credentials_blob.empty())
+                {
+                    LOG("Logging in with credentials blob");
+                    sp_session_login(spotify_, username_.c_str(), nullptr, config_.remember_me,
+                        config_.credentials_blob.c_str());
+                    return true;
+                }
+                break;
+            case LOGIN_PASSWORD:
+                if (!password_.empty())
+                {
+                    LOG("Logging in with password");
+                    sp_session_login(spotify_, username_.c_str(), password_.c_str(), config_.remember_me, nullptr);
+                    return true;
+                }
+                break;
+            case LOGIN_REMEMBERED:
+                if (sp_session_relogin(spotify_) == SP_ERROR_OK)
+                {
+                    LOG("Logging in as remembered user");
+                    return true;
+                }
+                break;
+            }
+        }
+
+        return false;
+    }
+
+    void shutdownSpotify()
+    {
+        LOG("Shutting down Spotify");
+        //sp_session_player_unload(spotify_);
+        sp_session_logout(spotify_);
+        sp_session_release(spotify_);
+        LOG("Released libspotify resources");
+    }
+
+    // Msg handling functions
+
+    int handleSpotifyProcess()
+    {
+        //LOG("handleSpotifyProcess");
+
+        // Notifications arriving from here on need a new pass
+        process_requested_ = false;
+
+        auto timeout = 0;
+        do
+        {
+            sp_session_process_events(spotify_, &timeout);
+        }
+        while (timeout == 0);
+
+        next_process_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+        // Metadata of the track to render may have arrived
+        if (render_ && render_->loading)
+            renderLoad();
+
+        // An album or playlist to enqueue has loaded, or the first one waiting has run out of time
+        if (!pending_enqueues_.empty() &&
+            (enqueue_loaded_ || std::chrono::steady_clock::now() >= pending_enqueues_.front().deadline))
+            processPendingEnqueues();
+
+        if (!tracks_loading_.empty() || !searches_loading_.empty())
+            checkMetadata();
+
+        // The restored track may have loaded
+        if (resume_position_ms_ >= 0)
+            resumePlayback();
+
+        return timeout;
+    }
+
+    void handleGetPlayQueue(Reply<std::vector<Track>>& reply)
+    {
+        reply.set(currentPlayQueueSnapshot()->getTracks());
+    }
+
+    void handleGetPlayQueueAsync(const TracksCallback& callback)
+    {
+        callback(currentPlayQueueSnapshot()->getTracks());
+    }
+
+    void handleGetPlayQueueSnapshot(Reply<std::shared_ptr<const PlayQueueSnapshot>>& reply)
+    {
+        reply.set(currentPlayQueueSnapshot());
+    }
+
+    // Get snapshot of the current play queue. The snapshot is only rebuilt when the queue has changed,
+    // and then only the metadata of the tracks not seen before is looked up. The snapshots share the interned
+    // strings with the play queue, so copying a track only copies the handles.
+    std::shared_ptr<const PlayQueueSnapshot> currentPlayQueueSnapshot()
+    {
+        if (queue_snapshot_ && queue_snapshot_->version == queue_version_)
+            return queue_snapshot_;
+
+        std::vector<TrackInfo> tracks;
+        tracks.reserve(play_queue_.size());
+
+        auto& strings = *strings_;
+        play_queue_.forEach([&tracks, &strings](QueueEntry& entry)
+        {
+            if (!entry.info.uri)
+            {
+                auto track = sp_link_as_track(entry.link);
+                auto info = getTrackInfo(strings, track, entry.link);
+
+                // Metadata of a track still loading is not kept. The queue version changes when it has loaded.
+                if (isLoading(track))
+                {
+                    tracks.push_back(std::move(info));
+                    return;
+                }
+
+                entry.info = std::move(info);
+            }
+
+            tracks.push_back(entry.info);
+        });
+
+        queue_snapshot_ = std::make_shared<const PlayQueueSnapshot>(queue_version_,
+            std::make_shared<const TrackInfoList>(strings_, std::move(tracks)));
+        return queue_snapshot_;
+    }
+
+    void handleEnqueue(const std::string& uri)
+    {
+        LOG("handleEnqueue " << uri);
+        addPendingEnqueue(uri);
+        processPendingEnqueues();
+    }
+
+    void handleEnqueueMany(const std::vector<std::string>& uris)
+    {
+        LOG("handleEnqueueMany " << uris.size() << " URIs");
+
+        for (const auto& uri : uris)
+            addPendingEnqueue(uri);
+
+        processPendingEnqueues();
+    }
+
+    void addPendingEnqueue(const std::string& uri)
+    {
+        auto* link = sp_link_create_from_string(uri.c_str());
+        const auto deadline = std::chrono::steady_clock::now() + ENQUEUE_LOAD_TIMEOUT;
+
+        if (!link)
+        {
+            LOG("Couldn't parse URI " << uri);
+            return;
+        }
+
+        switch (sp_link_type(link))
+        {
+        case SP_LINKTYPE_TRACK:
+            pending_enqueues_.push_back(PendingEnqueue(link, nullptr, nullptr, deadline));
+            return;
+        case SP_LINKTYPE_ALBUM:
+        {
+            auto album = sp_albumbrowse_create(spotify_, sp_link_as_album(link), &albumBrowseCompleteCallback, this);
+            pending_enqueues_.push_back(PendingEnqueue(nullptr, album, nullptr, deadline));
+            break;
+        }
+        case SP_LINKTYPE_PLAYLIST:
+        {
+            auto playlist = sp_playlist_create(spotify_, link);
+            if (playlist)
+            {
+                sp_playlist_add_callbacks(playlist, &playlist_cb_, this);
+                pending_enqueues_.push_back(PendingEnqueue(nullptr, nullptr, playlist, deadline));
+            }
+            else
+                LOG("Couldn't create playlist " << uri);
+            break;
+        }
+        default:
+            LOG("URI " << uri << " not track, album or playlist");
+            break;
+        }
+
+        sp_link_release(link);
+    }
+
+    // Move the pending enqueues to the play queue, in order, up to the first album or playlist not loaded yet.
+    // Called when one has loaded. An album or playlist that doesn't load by its deadline is dropped, so that
+    // it doesn't hold up the rest.
+    void processPendingEnqueues()
+    {
+        const auto old_size = play_queue_.size();
+        const auto now = std::chrono::steady_clock::now();
+        enqueue_loaded_ = false;
+
+        while (!pending_enqueues_.empty())
+        {
+            auto& item = pending_enqueues_.front();
+
+            if (item.album)
+            {
+                if (!sp_albumbrowse_is_loaded(item.album))
+                {
+                    if (now < item.deadline)
+                        break;
+                    else
+                        LOG("Album didn't load in time, dropping it");
+                }
+                else if (sp_albumbrowse_error(item.album) == SP_ERROR_OK)
+                {
+                    for (int i = 0; i < sp_albumbrowse_num_tracks(item.album); ++i)
+                    {
+                        auto track = sp_albumbrowse_track(item.album, i);
+                        queueTrack(play_queue_.size(), sp_link_create_from_track(track, 0));
+                    }
+                }
+                else
+                    LOG("Couldn't browse album: " << sp_error_message(sp_albumbrowse_error(item.album)));
+            }
+            else if (item.playlist)
+            {
+                if (sp_playlist_is_loaded(item.playlist))
+                {
+                    for (int i = 0; i < sp_playlist_num_tracks(item.playlist); ++i)
+                    {
+                        auto track = sp_playlist_track(item.playlist, i);
+                        queueTrack(play_queue_.size(), sp_link_create_from_track(track, 0));
+                    }
+                }
+                else if (now < item.deadline)
+                    break;
+                else
+                    LOG("Playlist didn't load in time, dropping it");
+            }
+            else
+            {
+                queueTrack(play_queue_.size(), item.link);
+                item.link = nullptr;
+            }
+
+            item.release(&playlist_cb_, this);
+            pending_enqueues_.pop_front();
+        }
+
+        if (play_queue_.size() != old_size)
+        {
+            LOG("Enqueued " << play_queue_.size() - old_size << " tracks");
+            queueChanged();
+        }
+    }
+
+    void handleInsert(int index, const std::string& uri)
+    {
+        LOG("handleInsert " << index << " " << uri);
+
+        if (index < 0 || index > play_queue_.size())
+        {
+            LOG("Invalid index");
+            return;
+        }
+
+        if (insertTrack(index, uri) && index == 0)
+            headChanged();
+    }
+
+    void handleRemove(int index)
+    {
+        LOG("handleRemove " << index);
+
+        if (!isValidIndex(index))
+            return;
+
+        sp_link_release(play_queue_.erase(index).link);
+        queueChanged();
+
+        if (index == 0)
+            headChanged();
+    }
+
+    void handleMove(int from, int to)
+    {
+        LOG("handleMove " << from << " -> " << to);
+
+        if (!isValidIndex(from) || !isValidIndex(to) || from == to)
+            return;
+
+        play_queue_.move(from, to);
+        queueChanged();
+
+        if (from == 0 || to == 0)
+            headChanged();
+    }
+
+    void handleShuffle()
+    {
+        LOG("handleShuffle");
+
+        // The track at the head may be playing, so it stays in place
+        if (play_queue_.size() > 2)
+        {
+            play_queue_.shuffle(1, play_queue_.size());
+            queueChanged();
+        }
+    }
+
+    bool insertTrack(int index, const std::string& uri)
+    {
+        auto* link = sp_link_create_from_string(uri.c_str());
+
+        if (!link)
+        {
+            LOG("Couldn't parse URI");
+            return false;
+        }
+
+        if (!sp_link_as_track(link))
+        {
+            LOG("URI not track");
+            sp_link_release(link);
+            return false;
+        }
+
+        queueTrack(index, link);
+        queueChanged();
+        return true;
+    }
+
+    // Add track to play queue, taking ownership of link. Tracks still loading are followed in checkMetadata().
+    void queueTrack(int index, sp_link* link)
+    {
+        play_queue_.insert(index, QueueEntry(link));
+
+        auto track = sp_link_as_track(link);
+        if (isLoading(track))
+        {
+            sp_track_add_ref(track);
+            tracks_loading_.push_back(track);
+        }
+    }
+
+    // Check in one batch if the tracks and searches waiting for metadata have loaded
+    void checkMetadata()
+    {
+        std::vector<Track> loaded;
+
+        auto it = std::partition(tracks_loading_.begin(), tracks_loading_.end(), &isLoading);
+        for (auto loaded_it = it; loaded_it != tracks_loading_.end(); ++loaded_it)
+        {
+            auto link = sp_link_create_from_track(*loaded_it, 0);
+            loaded.push_back(getTrack(*loaded_it, link));
+            sp_link_release(link);
+            sp_track_release(*loaded_it);
+        }
+        tracks_loading_.erase(it, tracks_loading_.end());
+
+        if (!loaded.empty())
+        {
+            LOG("Metadata loaded for " << loaded.size() << " tracks");
+
+            // Snapshots are rebuilt with the loaded metadata
+            queueChanged();
+
+            if (tracks_loaded_callback_)
+                tracks_loaded_callback_(loaded);
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < searches_loading_.size(); )
+        {
+            auto search = searches_loading_[i].first;
+            if (isSearchLoading(search) && now < searches_loading_[i].second)
+            {
+                ++i;
+                continue;
+            }
+
+            searches_loading_.erase(searches_loading_.begin() + i);
+            finishSearch(search);
+        }
+    }
+
+    static bool isSearchLoading(sp_search* search)
+    {
+        for (int i = 0; i < sp_search_num_tracks(search); ++i)
+        {
+            if (isLoading(sp_search_track(search, i)))
+                return true;
+        }
+
+        return false;
+    }
+
+    void queueChanged()
+    {
+        ++queue_version_;
+        events_.post(Event::QUEUE_CHANGED, queue_version_);
+    }
+
+    bool isValidIndex(int index)
+    {
+        if (index < 0 || index >= play_queue_.size())
+        {
+            LOG("Invalid index " << index << ", play queue size " << play_queue_.size());
+            return false;
+        }
+
+        return true;
+    }
+
+    // A different track is now at the head of the play queue. If the old head was playing, play the new one.
+    void headChanged()
+    {
+        if (playing_)
+        {
+            handleStop();
+            handlePlay();
+        }
+    }
+
+    void handlePlay()
+    {
+        LOG("handlePlay");
+
+        if (render_)
+        {
+            LOG("Rendering in progress");
+            return;
+        }
+
+        if (paused_)
+        {
+            handleResume();
+            return;
+        }
+
+        if (play_queue_.empty())
+        {
+            LOG("Play queue empty");
+            return;
+        }
+
+        CHECK_SP_ERR(sp_session_player_load(spotify_, sp_link_as_track(play_queue_.front().link)));
+        sp_session_player_play(spotify_, true);
+        playing_ = true;
+        setPosition(0);
+        events_.post(Event::TRACK_STARTED);
+    }
+
+    void handleStop(std::chrono::steady_clock::time_point requested = std::chrono::steady_clock::now())
+    {
+        LOG("handleStop");
+
+        if (render_)
+        {
+            LOG("Rendering in progress");
+            return;
+        }
+        sp_session_player_unload(spotify_);
+        sounds_.flush(requested);
+        playing_ = false;
+        clearPause();
+    }
+
+    void handlePause()
+    {
+        LOG("handlePause");
+
+        if (render_ || !playing_ || paused_)
+        {
+            LOG("Nothing to pause");
+            return;
+        }
+
+        // libspotify stops delivering, and the audio already buffered is kept for resume
+        sp_session_player_play(spotify_, false);
+        sounds_.pause();
+        paused_ = true;
+    }
+
+    void handleResume()
+    {
+        LOG("handleResume");
+
+        if (!paused_)
+        {
+            LOG("Not paused");
+            return;
+        }
+
+        sounds_.resume();
+        sp_session_player_play(spotify_, true);
+        paused_ = false;
+    }
+
+    void handleSeek(int position_ms)
+    {
+        LOG("handleSeek " << position_ms);
+
+        if (render_ || !playing_)
+        {
+            LOG("Nothing to seek");
+            return;
+        }
+
+        // The buffered audio is from the old position, and so is any delivery libspotify is making right now.
+        // The epoch is odd while seeking, and the audio delivered from before the seek is dropped in
+        // musicDelivery(). The output restarts with a short prebuffer, so the new position is heard quickly.
+        ++seek_epoch_;
+        sounds_.discard();
+        sp_session_player_seek(spotify_, std::max(position_ms, 0));
+        setPosition(std::max(position_ms, 0));
+        ++seek_epoch_;
+    }
+
+    // Position tracking. The position is counted from the audio accepted by the sound system.
+
+    void setPosition(int position_ms)
+    {
+        position_base_ms_ = position_ms;
+        frames_delivered_ = 0;
+    }
+
+    int getPosition() const
+    {
+        const int rate = delivery_rate_;
+        return rate > 0 ? position_base_ms_ + static_cast<int>(frames_delivered_ * 1000 / rate) : position_base_ms_;
+    }
+
+    // Playback state snapshots
+
+    // Read the state saved by the previous run. The equalizer is restored right away, the play queue once logged in.
+    void loadState()
+    {
+        std::unique_ptr<PlaybackState> state(new PlaybackState());
+        if (!readPlaybackState(config_.state_path, *state))
+            return;
+
+        LOG("Restoring state with " << state->uris.size() << " tracks from " << config_.state_path);
+
+        const auto& eq = state->eq_state;
+        sounds_.setGain(eq.gain);
+        sounds_.setBass(eq.bass);
+        sounds_.setMid(eq.mid);
+        sounds_.setTreble(eq.treble);
+        sounds_.setGraphicEqBands(eq.bands);
+        sounds_.setLowLatencyEq(eq.low_latency);
+        sounds_.setEqOn(eq.is_on);
+
+        restore_ = std::move(state);
+    }
+
+    // Put the restored tracks to the play queue in one go, ahead of anything enqueued before the login.
+    // If something was already started, it stays playing at the head.
+    void restoreQueue()
+    {
+        const int first = playing_ ? 1 : 0;
+        int index = first;
+        for (const auto& uri : restore_->uris)
+        {
+            auto* link = sp_link_create_from_string(uri.c_str());
+            if (link && sp_link_as_track(link))
+                queueTrack(index++, link);
+            else if (link)
+                sp_link_release(link);
+        }
+
+        LOG("Restored " << index - first << " tracks");
+        if (index > first)
+            queueChanged();
+
+        if (index > first && restore_->playing && !playing_)
+        {
+            resume_position_ms_ = restore_->position_ms;
+            resume_paused_ = restore_->paused;
+        }
+
+        restore_.reset();
+
+        if (resume_position_ms_ >= 0)
+            resumePlayback();
+    }
+
+    // Continue the restored playback once the track's metadata has loaded, as libspotify can't load it before
+    void resumePlayback()
+    {
+        if (render_ || playing_ || play_queue_.empty())
+        {
+            resume_position_ms_ = -1;
+            return;
+        }
+
+        auto track = sp_link_as_track(play_queue_.front().link);
+        if (isLoading(track))
+            return;
+
+        const auto position_ms = resume_position_ms_;
+        resume_position_ms_ = -1;
+
+        if (sp_track_error(track) != SP_ERROR_OK)
         {
-            auto msg = msg_queue_.get(msgReceiveTimeout);
-            switch (msg->getMsgId())
-            {
-            case MSG_TERMINATE:
-                keepRunning = false;
-                break;
-            case MSG_SPOTIFY_PROCESS:
-            case PolyM::MSG_TIMEOUT:
-                msgReceiveTimeout = handleSpotifyProcess();
-                break;
-            case MSG_GET_PLAY_QUEUE:
-                handleGetPlayQueue(msg->getUniqueId());
-                break;
-            case MSG_ENQUEUE:
-                handleEnqueue(dynamic_cast<PolyM::DataMsg<std::string>&>(*msg).getPayload());
-                break;
-            case MSG_PLAY:
-                handlePlay();
-                break;
-            case MSG_STOP:
-                handleStop();
-                break;
-            case MSG_NEXT:
-                handleNext();
-                break;
-            case MSG_SEARCH:
-                handleSearch(dynamic_cast<PolyM::DataMsg<SearchQuery>&>(*msg));
-                break;
-            }
+            LOG("Restored track not available");
+            return;
         }
 
-        shutdownSpotify();
+        LOG("Resuming restored playback at " << position_ms << " ms");
+        handlePlay();
+        if (position_ms > 0)
+            handleSeek(position_ms);
+        if (resume_paused_)
+            handlePause();
     }
 
-    void setupSpotify()
+    // Milliseconds until the next save, or -1 if the state isn't saved
+    int untilSave() const
     {
-        // set up session callbacks
-        std::memset(&spotify_cb_, 0, sizeof(spotify_cb_));
-        spotify_cb_.logged_in = &loggedInCallback;
-        spotify_cb_.notify_main_thread = &notifyMainCallback;
-        spotify_cb_.music_delivery = &musicDeliveryCallback;
-        spotify_cb_.end_of_track = &endOfTrackCallback;
+        if (config_.state_path.empty())
+            return -1;
 
-        // set up session conf
-        std::memset(&spotify_conf_, 0, sizeof(spotify_conf_));
-        spotify_conf_.api_version = SPOTIFY_API_VERSION;
-        spotify_conf_.cache_location = "";
-        spotify_conf_.application_key = spotify_appkey;
-        spotify_conf_.application_key_size = sizeof(spotify_appkey);
-        spotify_conf_.user_agent = "spotify-backstage";
-        spotify_conf_.callbacks = &spotify_cb_;
-        spotify_conf_.userdata = this; // get reference to this in static callbacks
+        const auto until_save = std::chrono::duration_cast<std::chrono::milliseconds>(
+            next_save_ - std::chrono::steady_clock::now()).count();
+        return std::max(0, static_cast<int>(until_save));
+    }
 
-        sp_session_create(&spotify_conf_, &spotify_);
-        sp_session_login(spotify_, username_.c_str(), password_.c_str(), false, NULL);
+    // Time to wait for messages in run(), so that the next save isn't missed. 0 = wait forever, as in Channel::get().
+    int waitTimeout(int timeout) const
+    {
+        const auto until_save = untilSave();
+        if (until_save < 0)
+            return timeout;
 
-        LOG("Spotify session created");
+        const auto save_timeout = std::max(1, until_save);
+        return timeout > 0 ? std::min(timeout, save_timeout) : save_timeout;
     }
 
-    void shutdownSpotify()
+    void saveStateIfDue()
     {
-        LOG("Shutting down Spotify");
-        //sp_session_player_unload(spotify_);
-        sp_session_logout(spotify_);
-        sp_session_release(spotify_);
-        LOG("Released libspotify resources");
+        if (config_.state_path.empty() || std::chrono::steady_clock::now() < next_save_)
+            return;
+
+        next_save_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(config_.state_save_interval_ms);
+        saveState(false);
     }
 
-    // Msg handling functions
+    // Hand the state to the writer. The final save on shutdown waits until the state is synced to the disk.
+    void saveState(bool sync)
+    {
+        // The state saved by the previous run isn't overwritten before it has been restored
+        if (restore_ || resume_position_ms_ >= 0)
+            return;
 
-    int handleSpotifyProcess()
+        PlaybackState state;
+        state.uris.reserve(play_queue_.size());
+        play_queue_.forEach([&state](QueueEntry& entry)
+        {
+            char uri[128];
+            sp_link_as_string(entry.link, uri, sizeof(uri));
+            state.uris.push_back(uri);
+        });
+
+        state.playing = playing_;
+        state.paused = paused_;
+        state.position_ms = playing_ ? getPosition() : 0;
+
+        if (sync)
+            state_writer_->writeAndSync(state);
+        else
+            state_writer_->write(state);
+    }
+
+    // Playback is no longer paused, because it was stopped
+    void clearPause()
     {
-        //LOG("handleSpotifyProcess");
+        if (paused_)
+        {
+            sounds_.resume();
+            paused_ = false;
+        }
+    }
 
-        auto timeout = 0;
-        do
+    void handleNext(std::chrono::steady_clock::time_point requested = std::chrono::steady_clock::now())
+    {
+        LOG("handleNext");
+
+        if (render_)
         {
-            sp_session_process_events(spotify_, &timeout);
+            LOG("Rendering in progress");
+            return;
         }
-        while (timeout == 0);
 
-        return timeout;
+        if (play_queue_.empty())
+        {
+            LOG("Play queue empty");
+            return;
+        }
+
+        handleStop(requested);
+        sp_link_release(play_queue_.erase(0).link);
+        queueChanged();
+        handlePlay();
     }
 
-    void handleGetPlayQueue(PolyM::MsgUID reqUid)
+    void handleSearch(const SearchQuery& query)
     {
-        PolyM::DataMsg<std::vector<Track>> response(MSG_GET_PLAY_QUEUE_RESPONSE);
+        const auto& callback = query.callback;
+
+        const SearchCache::Key key(query.query, query.num_results, query.offset);
+
+        std::vector<TrackInfo> cached;
+        if (search_cache_.get(key, cached))
+        {
+            LOG("Search results for query " << query.query << " found in cache");
+            const auto tracks = toTracks(cached);
+            callback(tracks);
+            events_.post(Event::SEARCH_COMPLETED, tracks.size());
+            return;
+        }
+
+        // Identical search already in progress, wait for its results
+        auto in_flight = searches_in_flight_.find(key);
+        if (in_flight != searches_in_flight_.end())
+        {
+            LOG("Attaching to search " << in_flight->second << " with query " << query.query);
+            search_req_map_.at(in_flight->second).callbacks.push_back(callback);
+            return;
+        }
 
-        for (const auto& link : play_queue_)
-            response.getPayload().push_back(getTrack(sp_link_as_track(link), link));
+        auto search = sp_search_create(spotify_, query.query.c_str(), query.offset, query.num_results,
+            0, 0, 0, 0, 0, 0, SP_SEARCH_STANDARD, &searchCompleteCallback, this);
+        LOG("Initiating search " << search << " with query " << query.query);
 
-        msg_queue_.respondTo(reqUid, std::move(response));
+        search_req_map_.insert(std::make_pair(search, PendingSearch(key, callback)));
+        searches_in_flight_[key] = search;
     }
 
-    void handleEnqueue(const std::string& uri)
+    void handleEndOfTrack()
     {
-        LOG("handleEnqueue " << uri);
+        if (render_)
+            renderNext();
+        else
+        {
+            events_.post(Event::TRACK_ENDED);
+            handleNext();
+        }
+    }
 
-        auto* link = sp_link_create_from_string(uri.c_str());
+    void handleRender(const RenderJob& job)
+    {
+        LOG("handleRender " << job.path);
 
-        if (!link)
+        if (render_)
         {
-            LOG("Couldn't parse URI");
+            LOG("Already rendering");
+            job.callback(RenderProgress(0, job.uris.size(), 0.0, true, false));
             return;
         }
 
-        if (!sp_link_as_track(link))
+        std::unique_ptr<Render> render(new Render(job));
+        for (const auto& uri : job.uris)
         {
-            LOG("URI not track");
+            auto* link = sp_link_create_from_string(uri.c_str());
+            if (link && sp_link_as_track(link))
+                render->links.push_back(link);
+            else
+            {
+                LOG("Not rendering " << uri << ", URI not track");
+                if (link)
+                    sp_link_release(link);
+            }
+        }
+
+        if (render->links.empty())
+        {
+            LOG("Nothing to render");
+            job.callback(RenderProgress(0, job.uris.size(), 0.0, true, false));
             return;
         }
 
-        play_queue_.push_back(link);
+        sp_session_player_unload(spotify_);
+        sounds_.flush();
+        playing_ = false;
+        clearPause();
+
+        {
+            std::lock_guard<std::mutex> lock(render_mutex_);
+            render_ = std::move(render);
+        }
+
+        renderLoad();
     }
 
-    void handlePlay()
+    void handleRenderFailed()
     {
-        LOG("handlePlay");
+        if (render_)
+            finishRender(false);
+    }
 
-        if (play_queue_.empty())
+    // Load the track to render. Retried from handleSpotifyProcess while the track is loading.
+    void renderLoad()
+    {
+        auto* track = sp_link_as_track(render_->links[render_->index]);
+        const auto err = sp_session_player_load(spotify_, track);
+        render_->loading = err == SP_ERROR_IS_LOADING;
+
+        if (render_->loading)
+            return;
+
+        if (err != SP_ERROR_OK)
         {
-            LOG("Play queue empty");
+            LOG("Couldn't load track for rendering: " << sp_error_message(err));
+            finishRender(false);
             return;
         }
 
-        CHECK_SP_ERR(sp_session_player_load(spotify_, sp_link_as_track(play_queue_.front())));
+        {
+            std::lock_guard<std::mutex> lock(render_mutex_);
+            render_->track_duration_ms = sp_track_duration(track);
+            render_->frames_rendered = 0;
+            render_->frames_reported = 0;
+        }
+
         sp_session_player_play(spotify_, true);
     }
 
-    void handleStop()
+    void renderNext()
     {
-        LOG("handleStop");
         sp_session_player_unload(spotify_);
-        sounds_.flush();
+
+        if (++render_->index < static_cast<int>(render_->links.size()))
+            renderLoad();
+        else
+            finishRender(true);
     }
 
-    void handleNext()
+    void finishRender(bool ok)
     {
-        LOG("handleNext");
+        sp_session_player_unload(spotify_);
 
-        if (play_queue_.empty())
+        std::unique_ptr<Render> render;
         {
-            LOG("Play queue empty");
-            return;
+            std::lock_guard<std::mutex> lock(render_mutex_);
+            render = std::move(render_);
         }
 
-        handleStop();
-        sp_link_release(play_queue_.front());
-        play_queue_.pop_front();
-        handlePlay();
-    }
+        ok = ok && !render->failed && render->writer.isOpen();
+        ok = render->writer.close() && ok;
 
-    void handleSearch(const PolyM::DataMsg<SearchQuery>& req)
-    {
-        const auto& query = req.getPayload();
-        auto search = sp_search_create(spotify_, query.query.c_str(), query.offset, query.num_results,
-            0, 0, 0, 0, 0, 0, SP_SEARCH_STANDARD, &searchCompleteCallback, this);
-        LOG("Initiating search " << search << " with query " << query.query);
-        search_req_map_[search] = req.getUniqueId();
+        LOG("Rendering to " << render->writer.getPath() << (ok ? " finished" : " failed"));
+        render->callback(RenderProgress(
+            std::min<int>(render->index, render->links.size() - 1), render->links.size(), ok ? 1.0 : 0.0, true, ok));
     }
 
     // Callbacks coming from libspotify internal thread
@@ -329,10 +1537,14 @@ private:
 
     // Callbacks coming from main (message processing) thread
 
-    static void loggedInCallback(sp_session*, sp_error error)
+    static void loggedInCallback(sp_session* sp, sp_error error)
     {
-        CHECK_SP_ERR(error);
-        LOG("Logged in ok");
+        static_cast<Impl*>(sp_session_userdata(sp))->loggedIn(error);
+    }
+
+    static void credentialsBlobUpdatedCallback(sp_session* sp, const char* blob)
+    {
+        static_cast<Impl*>(sp_session_userdata(sp))->credentialsBlobUpdated(blob);
     }
 
     static void searchCompleteCallback(sp_search* search, void* userdata)
@@ -340,66 +1552,327 @@ private:
         static_cast<Impl*>(userdata)->searchComplete(search);
     }
 
+    static void albumBrowseCompleteCallback(sp_albumbrowse*, void* userdata)
+    {
+        static_cast<Impl*>(userdata)->enqueueLoaded();
+    }
+
+    static void playlistStateChangedCallback(sp_playlist*, void* userdata)
+    {
+        static_cast<Impl*>(userdata)->enqueueLoaded();
+    }
+
     // Implementations for the callbacks
 
+    void loggedIn(sp_error error)
+    {
+        // A stale credentials blob falls back to the password
+        if (error != SP_ERROR_OK)
+        {
+            LOG("Login failed: " << sp_error_message(error));
+            if (login())
+                return;
+        }
+
+        CHECK_SP_ERR(error);
+        LOG("Logged in ok");
+        startup_.mark(StartupTimer::LOGGED_IN);
+
+        if (restore_)
+            restoreQueue();
+    }
+
+    void credentialsBlobUpdated(const char* blob)
+    {
+        LOG("Credentials blob updated");
+        if (config_.credentials_callback)
+            config_.credentials_callback(blob);
+    }
+
     void notifyMain()
     {
         //LOG("notifyMain");
-        msg_queue_.put(PolyM::Msg(MSG_SPOTIFY_PROCESS));
+        // Several notifications before the events are processed need only one pass
+        if (!process_requested_.exchange(true))
+            send(SpotifyProcess());
     }
 
     int musicDelivery(const sp_audioformat* format, const void* data, int num_frames)
     {
         //LOG("musicDelivery");
-        return sounds_.write(
-            format->sample_rate,
-            format->channels,
-            static_cast<const int16_t*>(data),
-            num_frames) ? num_frames : 0;
+        {
+            std::lock_guard<std::mutex> lock(render_mutex_);
+            if (render_)
+                return renderDelivery(format, static_cast<const int16_t*>(data), num_frames);
+        }
+
+        AudioAllocations::Scope counted;
+
+        // Taken before the generation, so that a delivery started before a seek sees the seek in either
+        // of them. libspotify delivers again the frames not taken during the seek.
+        const unsigned epoch = seek_epoch_;
+        if (epoch % 2 != 0)
+            return 0;
+
+        const auto generation = sounds_.getGeneration();
+        if (seek_epoch_ != epoch)
+        {
+            // From the old position
+            return num_frames;
+        }
+
+        if (!sounds_.write(format->sample_rate, format->channels, static_cast<const int16_t*>(data), num_frames,
+                generation))
+            return 0;
+
+        // Dropped by the discard, not counted in the new position
+        if (seek_epoch_ != epoch)
+            return num_frames;
+
+        delivery_rate_ = format->sample_rate;
+        frames_delivered_ += num_frames;
+        return num_frames;
+    }
+
+    // Render takes all the audio libspotify offers, so it's delivered as fast as it can be decoded.
+    // Called with render_mutex_ locked.
+    int renderDelivery(const sp_audioformat* format, const int16_t* data, int num_frames)
+    {
+        auto& render = *render_;
+        if (render.failed || num_frames == 0)
+            return num_frames;
+
+        if (!render.writer.write(format->sample_rate, format->channels, data, num_frames))
+            return failRender();
+
+        render.frames_rendered += num_frames;
+        if (render.frames_rendered - render.frames_reported >= format->sample_rate)
+        {
+            render.frames_reported = render.frames_rendered;
+            render.callback(RenderProgress(
+                render.index, render.links.size(), render.getProgress(format->sample_rate), false, false));
+        }
+
+        return num_frames;
+    }
+
+    // Called with render_mutex_ locked
+    int failRender()
+    {
+        render_->failed = true;
+        send(RenderFailed());
+
+        // The audio delivered until the render is stopped is swallowed
+        return 0;
     }
 
     void endOfTrack()
     {
         LOG("endOfTrack");
-        next();
+        send(EndOfTrack());
+    }
+
+    // The pending enqueues are processed after the libspotify events, as this is called in the middle of them
+    void enqueueLoaded()
+    {
+        enqueue_loaded_ = true;
     }
 
     void searchComplete(sp_search* search)
     {
         LOG("Got results for search " << search);
 
-        PolyM::DataMsg<std::vector<Track>> response(MSG_SEARCH_RESPONSE);
+        // Hold the results back until the tracks' metadata has loaded
+        if (isSearchLoading(search))
+        {
+            const auto deadline = std::chrono::steady_clock::now() + SEARCH_METADATA_TIMEOUT;
+            searches_loading_.push_back(std::make_pair(search, deadline));
+            return;
+        }
+
+        finishSearch(search);
+    }
+
+    void finishSearch(sp_search* search)
+    {
+        std::vector<TrackInfo> infos;
 
         for (int i = 0; i < sp_search_num_tracks(search); ++i)
         {
             auto track = sp_search_track(search, i);
             auto link = sp_link_create_from_track(track, 0);
-            response.getPayload().push_back(getTrack(track, link));
+            infos.push_back(getTrackInfo(*strings_, track, link));
             sp_link_release(link);
         }
 
-        msg_queue_.respondTo(search_req_map_[search], std::move(response));
+        const auto tracks = toTracks(infos);
+
+        auto req = search_req_map_.find(search);
+        if (req != search_req_map_.end())
+        {
+            const auto pending = req->second;
+            search_req_map_.erase(req);
+            searches_in_flight_.erase(pending.key);
+
+            // Failed or incomplete searches are not cached, so that they're retried next time
+            if (sp_search_error(search) == SP_ERROR_OK && !isSearchLoading(search))
+                search_cache_.put(pending.key, infos);
+
+            for (const auto& callback : pending.callbacks)
+                callback(tracks);
+
+            // Once per search, however many identical requests it served
+            events_.post(Event::SEARCH_COMPLETED, tracks.size());
+        }
 
-        search_req_map_.erase(search);
         sp_search_release(search);
     }
 
-    const std::string& username_;
-    const std::string& password_;
+    // Copied, as the login may happen after the constructor has returned
+    const std::string username_;
+    const std::string password_;
+    const SpotifyBackstage::Config config_;
+    // Next LoginMethod to try
+    int login_method_;
     SoundSystem& sounds_;
-    PolyM::Queue msg_queue_;
+    EventDispatcher& events_;
+    StartupTimer& startup_;
+    ThreadSetup& threads_;
+    Channel<Msg> channel_;
+    // SpotifyProcess message is in the channel
+    std::atomic<bool> process_requested_;
+    // Embedded mode: readable when processEvents() needs to be called. -1 when running in own thread.
+    int event_fd_;
+    // event_fd_ has been written to since the last processEvents()
+    std::atomic<bool> wake_pending_;
+    // When libspotify wants its events processed next
+    std::chrono::steady_clock::time_point next_process_;
     sp_session_callbacks spotify_cb_;
+    // Registered to the playlists waiting to be enqueued
+    sp_playlist_callbacks playlist_cb_;
     sp_session_config spotify_conf_;
     sp_session* spotify_;
-    std::list<sp_link*> play_queue_;
-    std::map<sp_search*, PolyM::MsgUID> search_req_map_;
+    // Metadata strings of the play queue and the cached search results. Shared with the play queue snapshots,
+    // which may outlive the session. Declared before the queue and the cache, as they release their strings to this.
+    std::shared_ptr<StringTable> strings_;
+
+    // Entry in the play queue. The metadata is looked up when it's first needed, once the track has loaded.
+    struct QueueEntry
+    {
+        explicit QueueEntry(sp_link* link_p) : link(link_p), info()
+        {
+        }
+        // The play queue moves the entries around. The link is released when the entry is removed from the queue,
+        // not when a copy is destroyed.
+        QueueEntry(const QueueEntry&) = default;
+        QueueEntry& operator=(const QueueEntry&) = default;
+        QueueEntry(QueueEntry&&) = default;
+        QueueEntry& operator=(QueueEntry&&) = default;
+
+        sp_link* link;
+        TrackInfo info;
+    };
+
+    IndexedList<QueueEntry> play_queue_;
+    // Incremented on every change to play_queue_
+    long long queue_version_;
+    // Latest complete snapshot of play_queue_
+    std::shared_ptr<const PlayQueueSnapshot> queue_snapshot_;
+    // Is the track at the head of play_queue_ playing?
+    bool playing_;
+    // Is the playing track paused?
+    bool paused_;
+    // Position of the playing track is position_base_ms_ plus the frames delivered since.
+    // The frames are counted in libspotify thread.
+    int position_base_ms_;
+    std::atomic<long long> frames_delivered_;
+    std::atomic<int> delivery_rate_;
+    // Incremented at the start and at the end of a seek, so it's odd while seeking
+    std::atomic<unsigned> seek_epoch_;
+
+    // State read from the state file, until the play queue has been restored
+    std::unique_ptr<PlaybackState> restore_;
+    // Restored playback waiting for the track to load. -1 = none.
+    int resume_position_ms_;
+    bool resume_paused_;
+    std::chrono::steady_clock::time_point next_save_;
+    // Set if the state is saved
+    std::unique_ptr<StateWriter> state_writer_;
+
+    // Track, album or playlist waiting to be added to the end of the play queue.
+    // Only one of the pointers is set.
+    struct PendingEnqueue
+    {
+        PendingEnqueue(sp_link* link_p, sp_albumbrowse* album_p, sp_playlist* playlist_p,
+            std::chrono::steady_clock::time_point deadline_p)
+          : link(link_p), album(album_p), playlist(playlist_p), deadline(deadline_p)
+        {
+        }
+
+        // The callbacks registered to the playlist are removed
+        void release(sp_playlist_callbacks* playlist_cb, void* userdata) const
+        {
+            if (link)
+                sp_link_release(link);
+            if (album)
+                sp_albumbrowse_release(album);
+            if (playlist)
+            {
+                sp_playlist_remove_callbacks(playlist, playlist_cb, userdata);
+                sp_playlist_release(playlist);
+            }
+        }
+
+        sp_link* link;
+        sp_albumbrowse* album;
+        sp_playlist* playlist;
+        // Albums and playlists not loaded by then are dropped
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    // Albums and playlists are enqueued when they have loaded. The items after them wait, to keep the order.
+    std::deque<PendingEnqueue> pending_enqueues_;
+    // Set when an album or playlist has loaded, or a playlist's state has changed otherwise
+    bool enqueue_loaded_;
+
+    // Tracks in the play queue waiting for metadata. Each holds a reference.
+    std::vector<sp_track*> tracks_loading_;
+    // Completed searches waiting for the metadata of their tracks, with deadlines
+    std::vector<std::pair<sp_search*, std::chrono::steady_clock::time_point>> searches_loading_;
+    TracksCallback tracks_loaded_callback_;
+    // Search in progress, and everyone waiting for its results
+    struct PendingSearch
+    {
+        PendingSearch(const SearchCache::Key& key_p, const TracksCallback& callback)
+          : key(key_p), callbacks(1, callback)
+        {
+        }
+        SearchCache::Key key;
+        std::vector<TracksCallback> callbacks;
+    };
+
+    std::map<sp_search*, PendingSearch> search_req_map_;
+    std::map<SearchCache::Key, sp_search*> searches_in_flight_;
+    SearchCache search_cache_;
+    std::mutex render_mutex_;
+    std::unique_ptr<Render> render_;
     std::thread thread_;
 };
 
-SpotifySession::SpotifySession(
-    const std::string& username, const std::string& password, SoundSystem& sounds)
-  : impl_(new Impl(username, password, sounds))
+SpotifySession::SpotifySession(const std::string& username, const std::string& password, SoundSystem& sounds,
+    EventDispatcher& events, StartupTimer& startup, ThreadSetup& threads, const SpotifyBackstage::Config& config)
+  : impl_(new Impl(username, password, sounds, events, startup, threads, config))
+{
+}
+
+int SpotifySession::getEventFd() const
+{
+    return impl_->getEventFd();
+}
+
+int SpotifySession::processEvents()
 {
+    return impl_->processEvents();
 }
 
 SpotifySession::~SpotifySession()
@@ -411,11 +1884,51 @@ std::vector<Track> SpotifySession::getPlayQueue()
     return impl_->getPlayQueue();
 }
 
+void SpotifySession::getPlayQueueAsync(const TracksCallback& callback)
+{
+    impl_->getPlayQueueAsync(callback);
+}
+
+std::shared_ptr<const PlayQueueSnapshot> SpotifySession::getPlayQueueSnapshot()
+{
+    return impl_->getPlayQueueSnapshot();
+}
+
 void SpotifySession::enqueue(const std::string& uri)
 {
     impl_->enqueue(uri);
 }
 
+void SpotifySession::enqueue(const std::vector<std::string>& uris)
+{
+    impl_->enqueue(uris);
+}
+
+void SpotifySession::setTracksLoadedCallback(const std::function<void(const std::vector<Track>&)>& callback)
+{
+    impl_->setTracksLoadedCallback(callback);
+}
+
+void SpotifySession::insert(int index, const std::string& uri)
+{
+    impl_->insert(index, uri);
+}
+
+void SpotifySession::remove(int index)
+{
+    impl_->remove(index);
+}
+
+void SpotifySession::move(int from, int to)
+{
+    impl_->move(from, to);
+}
+
+void SpotifySession::shuffle()
+{
+    impl_->shuffle();
+}
+
 void SpotifySession::play()
 {
     impl_->play();
@@ -426,6 +1939,21 @@ void SpotifySession::stop()
     impl_->stop();
 }
 
+void SpotifySession::pause()
+{
+    impl_->pause();
+}
+
+void SpotifySession::resume()
+{
+    impl_->resume();
+}
+
+void SpotifySession::seek(int position_ms)
+{
+    impl_->seek(position_ms);
+}
+
 void SpotifySession::next()
 {
     impl_->next();
@@ -437,4 +1965,16 @@ std::vector<Track> SpotifySession::search(
     return impl_->search(query, num_results, offset);
 }
 
+void SpotifySession::searchAsync(
+    const std::string& query, int num_results, int offset, const TracksCallback& callback)
+{
+    impl_->searchAsync(query, num_results, offset, callback);
+}
+
+void SpotifySession::render(const std::vector<std::string>& uris, const std::string& path,
+    const EqState& eq_state, const RenderCallback& callback)
+{
+    impl_->render(uris, path, eq_state, callback);
+}
+
 }
@@ -1,26 +1,52 @@
 #ifndef SPOTIFY_BACKSTAGE_SPOTIFYSESSION_HPP
 #define SPOTIFY_BACKSTAGE_SPOTIFYSESSION_HPP
 
+#include "SpotifyBackstage.hpp"
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
 
 namespace spotify_backstage {
 
+class EventDispatcher;
 class SoundSystem;
+class StartupTimer;
+class ThreadSetup;
+struct EqState;
+struct PlayQueueSnapshot;
+struct RenderProgress;
 struct Track;
 
 class SpotifySession
 {
 public:
-    SpotifySession(const std::string& username, const std::string& password, SoundSystem& sounds);
+    SpotifySession(const std::string& username, const std::string& password, SoundSystem& sounds,
+        EventDispatcher& events, StartupTimer& startup, ThreadSetup& threads, const SpotifyBackstage::Config& config);
     ~SpotifySession();
+    int getEventFd() const;
+    int processEvents();
     std::vector<Track> getPlayQueue();
+    void getPlayQueueAsync(const std::function<void(const std::vector<Track>&)>& callback);
+    std::shared_ptr<const PlayQueueSnapshot> getPlayQueueSnapshot();
     void enqueue(const std::string& uri);
+    void enqueue(const std::vector<std::string>& uris);
+    void setTracksLoadedCallback(const std::function<void(const std::vector<Track>&)>& callback);
+    void insert(int index, const std::string& uri);
+    void remove(int index);
+    void move(int from, int to);
+    void shuffle();
     void play();
     void stop();
+    void pause();
+    void resume();
+    void seek(int position_ms);
     void next();
     std::vector<Track> search(const std::string& query, int num_results, int offset);
+    void searchAsync(const std::string& query, int num_results, int offset,
+        const std::function<void(const std::vector<Track>&)>& callback);
+    void render(const std::vector<std::string>& uris, const std::string& path, const EqState& eq_state,
+        const std::function<void(const RenderProgress&)>& callback);
 
 private:
     class Impl;
@@ -0,0 +1,41 @@
+#include "StartupTimer.hpp"
+
+#include "Logger.hpp"
+
+namespace spotify_backstage {
+
+namespace {
+const char* const PHASE_NAMES[] = { "Constructed", "Audio initialized", "Logged in", "First audio" };
+}
+
+StartupTimer::StartupTimer()
+  : start_(std::chrono::steady_clock::now())
+{
+    for (auto& time : times_us_)
+        time = -1;
+}
+
+void StartupTimer::mark(Phase phase)
+{
+    if (times_us_[phase] >= 0)
+        return;
+
+    const auto time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start_).count();
+
+    long long unset = -1;
+    if (times_us_[phase].compare_exchange_strong(unset, time_us))
+        LOG(PHASE_NAMES[phase] << " in " << time_us / 1000 << " ms");
+}
+
+StartupTimes StartupTimer::getTimes() const
+{
+    StartupTimes times;
+    times.constructed = std::chrono::microseconds(times_us_[CONSTRUCTED]);
+    times.audio_initialized = std::chrono::microseconds(times_us_[AUDIO_INITIALIZED]);
+    times.logged_in = std::chrono::microseconds(times_us_[LOGGED_IN]);
+    times.first_audio = std::chrono::microseconds(times_us_[FIRST_AUDIO]);
+    return times;
+}
+
+}
@@ -0,0 +1,38 @@
+#ifndef SPOTIFY_BACKSTAGE_STARTUPTIMER_HPP
+#define SPOTIFY_BACKSTAGE_STARTUPTIMER_HPP
+
+#include "SpotifyBackstage.hpp"
+#include <atomic>
+#include <chrono>
+
+namespace spotify_backstage {
+
+// Measures the startup phases from the construction of the timer. The phases can be marked from any thread.
+class StartupTimer
+{
+public:
+    enum Phase
+    {
+        CONSTRUCTED,
+        AUDIO_INITIALIZED,
+        LOGGED_IN,
+        FIRST_AUDIO,
+        NUM_PHASES
+    };
+
+    StartupTimer();
+
+    // Record the time of reaching phase. Only the first mark of each phase counts.
+    void mark(Phase phase);
+
+    StartupTimes getTimes() const;
+
+private:
+    const std::chrono::steady_clock::time_point start_;
+    // Microseconds from start, -1 if not reached yet
+    std::atomic<long long> times_us_[NUM_PHASES];
+};
+
+}
+
+#endif
@@ -0,0 +1,136 @@
+#include "StateWriter.hpp"
+
+#include "PlaybackState.hpp"
+#include "SoundSystem.hpp"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace spotify_backstage {
+
+class StateWriter::Impl
+{
+public:
+    Impl(const std::string& path, SoundSystem& sounds)
+      : path_(path),
+        sounds_(sounds),
+        mutex_(),
+        wake_(),
+        done_(),
+        pending_(),
+        has_pending_(false),
+        sync_pending_(false),
+        num_queued_(0),
+        num_done_(0),
+        terminate_(false),
+        saved_(),
+        saved_synced_(false),
+        thread_(&Impl::run, this)
+    {
+    }
+
+    ~Impl()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            terminate_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+    }
+
+    void write(const PlaybackState& state, bool sync)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        pending_ = state;
+        has_pending_ = true;
+        // A replaced state may have been waiting for a sync
+        sync_pending_ = sync_pending_ || sync;
+        const auto ticket = ++num_queued_;
+        wake_.notify_one();
+
+        if (sync)
+            done_.wait(lock, [this, ticket] { return num_done_ >= ticket; });
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true)
+        {
+            // The pending state is written before terminating
+            wake_.wait(lock, [this] { return has_pending_ || terminate_; });
+            if (!has_pending_)
+                return;
+
+            auto state = pending_;
+            const bool sync = sync_pending_;
+            const auto ticket = num_queued_;
+            has_pending_ = false;
+            sync_pending_ = false;
+
+            lock.unlock();
+            save(state, sync);
+            lock.lock();
+
+            num_done_ = ticket;
+            done_.notify_all();
+        }
+    }
+
+    void save(PlaybackState& state, bool sync)
+    {
+        state.eq_state = sounds_.getEqState();
+
+        auto data = encodePlaybackState(state);
+        if (data == saved_ && (saved_synced_ || !sync))
+            return;
+
+        if (writePlaybackState(path_, data, sync))
+        {
+            saved_ = std::move(data);
+            saved_synced_ = sync;
+        }
+    }
+
+    const std::string path_;
+    SoundSystem& sounds_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    // Latest state not written yet
+    PlaybackState pending_;
+    bool has_pending_;
+    bool sync_pending_;
+    // Number of states queued, and the number of the latest one written. A written state covers the ones it replaced.
+    unsigned long long num_queued_;
+    unsigned long long num_done_;
+    bool terminate_;
+    // Used only in the writer thread. Contents of the state file last written.
+    std::vector<char> saved_;
+    bool saved_synced_;
+    std::thread thread_;
+};
+
+StateWriter::StateWriter(const std::string& path, SoundSystem& sounds)
+  : impl_(new Impl(path, sounds))
+{
+}
+
+StateWriter::~StateWriter()
+{
+}
+
+void StateWriter::write(const PlaybackState& state)
+{
+    impl_->write(state, false);
+}
+
+void StateWriter::writeAndSync(const PlaybackState& state)
+{
+    impl_->write(state, true);
+}
+
+}
@@ -0,0 +1,34 @@
+#ifndef SPOTIFY_BACKSTAGE_STATEWRITER_HPP
+#define SPOTIFY_BACKSTAGE_STATEWRITER_HPP
+
+#include <memory>
+#include <string>
+
+namespace spotify_backstage {
+
+struct PlaybackState;
+class SoundSystem;
+
+// Writes the playback state to the state file in a thread of its own, so that the session thread doesn't wait for
+// the disk or the sound system. Only the latest state is kept: a state replaces the one still waiting to be written.
+// The file is written only when its contents change.
+class StateWriter
+{
+public:
+    StateWriter(const std::string& path, SoundSystem& sounds);
+    ~StateWriter();
+
+    // Queue state to be written. The equalizer state is taken from the sound system when writing.
+    // The file isn't synced, so the state may be lost if the system crashes soon after, but never left partial.
+    void write(const PlaybackState& state);
+    // Write state and sync it to the disk. Returns when done.
+    void writeAndSync(const PlaybackState& state);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+}
+
+#endif
@@ -0,0 +1,110 @@
+#include "StringTable.hpp"
+
+#include <tuple>
+#include <utility>
+
+namespace spotify_backstage {
+
+InternedString::InternedString()
+  : node_(nullptr)
+{
+}
+
+// Called with the table locked
+InternedString::InternedString(Node* node)
+  : node_(node)
+{
+    ++node_->second.refs;
+}
+
+// Another handle to the string exists, so the table can't remove it meanwhile
+InternedString::InternedString(const InternedString& other)
+  : node_(other.node_)
+{
+    if (node_)
+        node_->second.refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+InternedString::InternedString(InternedString&& other)
+  : node_(other.node_)
+{
+    other.node_ = nullptr;
+}
+
+InternedString& InternedString::operator=(InternedString other)
+{
+    std::swap(node_, other.node_);
+    return *this;
+}
+
+InternedString::~InternedString()
+{
+    if (!node_)
+        return;
+
+    // Only the last handle needs the table locked, as intern() may hand out a new handle meanwhile
+    auto& refs = node_->second.refs;
+    auto count = refs.load();
+    while (count > 1)
+    {
+        if (refs.compare_exchange_weak(count, count - 1))
+            return;
+    }
+
+    node_->second.table.release(node_);
+}
+
+InternedString::operator bool() const
+{
+    return node_ != nullptr;
+}
+
+const std::string& InternedString::str() const
+{
+    static const std::string empty;
+    return node_ ? node_->first : empty;
+}
+
+StringTable::StringTable()
+  : mutex_(), nodes_(), probe_()
+{
+}
+
+InternedString StringTable::intern(const char* str)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    probe_.assign(str);
+
+    auto it = nodes_.find(probe_);
+    if (it == nodes_.end())
+    {
+        it = nodes_.emplace(std::piecewise_construct, std::forward_as_tuple(probe_),
+            std::forward_as_tuple(*this)).first;
+    }
+
+    return InternedString(&*it);
+}
+
+InternedString StringTable::intern(const std::string& str)
+{
+    return intern(str.c_str());
+}
+
+int StringTable::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return nodes_.size();
+}
+
+void StringTable::release(InternedString::Node* node)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--node->second.refs > 0)
+        return;
+
+    // Looked up by the iterator, as the key is part of the node being erased
+    auto it = nodes_.find(node->first);
+    nodes_.erase(it);
+}
+
+}
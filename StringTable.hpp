@@ -0,0 +1,115 @@
+#ifndef SPOTIFY_BACKSTAGE_STRINGTABLE_HPP
+#define SPOTIFY_BACKSTAGE_STRINGTABLE_HPP
+
+#include "SpotifyBackstage.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace spotify_backstage {
+
+class StringTable;
+
+// Reference counted handle to a string in StringTable. Copies share the string. The string is removed from the
+// table when the last handle to it is gone. Empty handles refer to the empty string.
+// The handles to the same string can be copied and destroyed in different threads.
+class InternedString
+{
+public:
+    InternedString();
+    InternedString(const InternedString& other);
+    InternedString(InternedString&& other);
+    InternedString& operator=(InternedString other);
+    ~InternedString();
+
+    explicit operator bool() const;
+    const std::string& str() const;
+
+private:
+    friend class StringTable;
+
+    struct Entry
+    {
+        explicit Entry(StringTable& table_p) : refs(0), table(table_p)
+        {
+        }
+        std::atomic<int> refs;
+        StringTable& table;
+    };
+    typedef std::unordered_map<std::string, Entry>::value_type Node;
+
+    explicit InternedString(Node* node);
+
+    Node* node_;
+};
+
+// Table of interned strings. Each distinct string is stored once, however many handles refer to it.
+// Thread safe. The table must outlive the handles to it.
+class StringTable
+{
+public:
+    StringTable();
+    StringTable(const StringTable&) = delete;
+    StringTable& operator=(const StringTable&) = delete;
+
+    InternedString intern(const char* str);
+    InternedString intern(const std::string& str);
+
+    // Number of distinct strings
+    int size() const;
+
+private:
+    friend class InternedString;
+    void release(InternedString::Node* node);
+
+    // Protects the nodes, and the reference counts dropping to 0
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, InternedString::Entry> nodes_;
+    // Reused for the lookups, to avoid allocating a string for each
+    std::string probe_;
+};
+
+// Metadata of a track, with the strings interned. Copying is cheap, as the strings are shared.
+struct TrackInfo
+{
+    TrackInfo() : artist(), album(), track(), duration_sec(0), uri()
+    {
+    }
+
+    TrackInfo(const InternedString& artist_p, const InternedString& album_p, const InternedString& track_p,
+        int duration_sec_p, const InternedString& uri_p)
+      : artist(artist_p), album(album_p), track(track_p), duration_sec(duration_sec_p), uri(uri_p)
+    {
+    }
+
+    Track toTrack() const
+    {
+        return Track(artist.str(), album.str(), track.str(), duration_sec, uri.str());
+    }
+
+    InternedString artist;
+    InternedString album;
+    InternedString track;
+    int duration_sec;
+    InternedString uri;
+};
+
+// Tracks of a play queue snapshot. Holds the string table, as the snapshot may outlive the session.
+struct TrackInfoList
+{
+    TrackInfoList(const std::shared_ptr<StringTable>& strings_p, std::vector<TrackInfo> tracks_p)
+      : strings(strings_p), tracks(std::move(tracks_p))
+    {
+    }
+
+    // Declared first, so that it's destroyed after the tracks
+    std::shared_ptr<StringTable> strings;
+    std::vector<TrackInfo> tracks;
+};
+
+}
+
+#endif
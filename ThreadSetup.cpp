@@ -0,0 +1,131 @@
+#include "ThreadSetup.hpp"
+
+#include "Logger.hpp"
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace spotify_backstage {
+
+namespace {
+
+const char* const THREAD_NAMES[] = { "Audio", "Session" };
+
+void addError(std::string& errors, const std::string& setting, int err)
+{
+    if (!errors.empty())
+        errors += ", ";
+
+    errors += setting + ": " + std::strerror(err);
+}
+
+}
+
+ThreadSetup::ThreadSetup(const SpotifyBackstage::Config& config)
+  : configs_{config.audio_thread, config.session_thread},
+    lock_memory_(config.lock_memory),
+    lock_failed_(false),
+    mutex_(),
+    status_()
+{
+}
+
+void ThreadSetup::apply(Thread thread)
+{
+    const auto status = applyConfig(configs_[thread]);
+
+    if (status.error.empty())
+        LOG(THREAD_NAMES[thread] << " thread set up");
+    else
+        LOG(THREAD_NAMES[thread] << " thread setup failed: " << status.error);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    (thread == AUDIO ? status_.audio_thread : status_.session_thread) = status;
+}
+
+void ThreadSetup::applyToHelper(Thread thread)
+{
+    const auto status = applyConfig(configs_[thread]);
+
+    if (!status.error.empty())
+        LOG(THREAD_NAMES[thread] << " helper thread setup failed: " << status.error);
+}
+
+ThreadStatus ThreadSetup::applyConfig(const ThreadConfig& config) const
+{
+    ThreadStatus status;
+    status.started = true;
+
+    if (config.policy != ThreadConfig::DEFAULT)
+    {
+        sched_param param;
+        std::memset(&param, 0, sizeof(param));
+        param.sched_priority = config.priority;
+
+        const int policy = config.policy == ThreadConfig::FIFO ? SCHED_FIFO : SCHED_RR;
+        const int err = pthread_setschedparam(pthread_self(), policy, &param);
+        status.scheduling = err == 0;
+        if (err != 0)
+            addError(status.error, "scheduling", err);
+    }
+    else if (config.nice != 0)
+    {
+        // On Linux, the nice value is per thread
+        status.scheduling = setpriority(PRIO_PROCESS, syscall(SYS_gettid), config.nice) == 0;
+        if (!status.scheduling)
+            addError(status.error, "nice", errno);
+    }
+
+    if (!config.cpus.empty())
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (auto cpu : config.cpus)
+        {
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &cpus);
+        }
+
+        const int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        status.affinity = err == 0;
+        if (err != 0)
+            addError(status.error, "affinity", err);
+    }
+
+    return status;
+}
+
+void ThreadSetup::lockMemory(const void* addr, std::size_t size)
+{
+    if (!lock_memory_)
+        return;
+
+    // Only the given regions are locked, not the whole process. Locking everything would count every later
+    // allocation and thread stack against RLIMIT_MEMLOCK, and they would start failing once it's reached.
+    const bool locked = mlock(addr, size) == 0;
+    const int err = errno;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (locked)
+        LOG("Locked " << size << " bytes of memory");
+    else
+    {
+        lock_failed_ = true;
+        addError(status_.memory_error, "mlock", err);
+        LOG("Couldn't lock memory: " << std::strerror(err));
+    }
+    status_.memory_locked = !lock_failed_;
+}
+
+RealtimeStatus ThreadSetup::getStatus() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return status_;
+}
+
+}
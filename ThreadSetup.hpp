@@ -0,0 +1,49 @@
+#ifndef SPOTIFY_BACKSTAGE_THREADSETUP_HPP
+#define SPOTIFY_BACKSTAGE_THREADSETUP_HPP
+
+#include "SpotifyBackstage.hpp"
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+namespace spotify_backstage {
+
+// Applies the scheduling, CPU affinity and memory locking settings of Config, and keeps track of what was applied.
+class ThreadSetup
+{
+public:
+    enum Thread
+    {
+        AUDIO,
+        SESSION,
+        NUM_THREADS
+    };
+
+    explicit ThreadSetup(const SpotifyBackstage::Config& config);
+
+    // Apply the settings of thread to the calling thread
+    void apply(Thread thread);
+    // Apply the settings of thread to the calling helper thread, which thread waits for. Without them, the helper
+    // could be preempted by anything below the real time priority of thread, holding thread up.
+    // The status of the helpers isn't reported.
+    void applyToHelper(Thread thread);
+
+    // Lock a region of memory used on the audio path, if requested. The region stays locked until it's freed.
+    void lockMemory(const void* addr, std::size_t size);
+
+    RealtimeStatus getStatus() const;
+
+private:
+    ThreadStatus applyConfig(const ThreadConfig& config) const;
+
+    const ThreadConfig configs_[NUM_THREADS];
+    const bool lock_memory_;
+    bool lock_failed_;
+
+    mutable std::mutex mutex_;
+    RealtimeStatus status_;
+};
+
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef SPOTIFY_BACKSTAGE_VARIANT_HPP
+#define SPOTIFY_BACKSTAGE_VARIANT_HPP
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace spotify_backstage {
+
+namespace detail {
+
+template<typename... Ts>
+struct MaxSize;
+
+template<>
+struct MaxSize<>
+{
+    static const size_t size = 1;
+    static const size_t align = 1;
+};
+
+template<typename T, typename... Ts>
+struct MaxSize<T, Ts...>
+{
+    static const size_t size = sizeof(T) > MaxSize<Ts...>::size ? sizeof(T) : MaxSize<Ts...>::size;
+    static const size_t align = alignof(T) > MaxSize<Ts...>::align ? alignof(T) : MaxSize<Ts...>::align;
+};
+
+// Index of T in Ts
+template<typename T, typename... Ts>
+struct IndexOf;
+
+template<typename T, typename... Ts>
+struct IndexOf<T, T, Ts...>
+{
+    static const int value = 0;
+};
+
+template<typename T, typename U, typename... Ts>
+struct IndexOf<T, U, Ts...>
+{
+    static const int value = 1 + IndexOf<T, Ts...>::value;
+};
+
+}
+
+// Tagged union of Ts, holding one of them or nothing. The value is stored inline, so creating a Variant never
+// allocates. visit() calls the visitor with the value through a jump table, without RTTI.
+template<typename... Ts>
+class Variant
+{
+public:
+    Variant() : storage_(), index_(-1)
+    {
+    }
+
+    template<typename T, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<T>::type, Variant>::value>::type>
+    Variant(T&& value) : storage_(), index_(-1)
+    {
+        typedef typename std::decay<T>::type Type;
+        new (&storage_) Type(std::forward<T>(value));
+        index_ = detail::IndexOf<Type, Ts...>::value;
+    }
+
+    Variant(Variant&& other) : storage_(), index_(-1)
+    {
+        *this = std::move(other);
+    }
+
+    Variant& operator=(Variant&& other)
+    {
+        if (this != &other)
+        {
+            reset();
+            if (other.index_ >= 0)
+            {
+                static const MoveFn move_fns[] = { &moveValue<Ts>... };
+                move_fns[other.index_](&other.storage_, &storage_);
+                index_ = other.index_;
+                other.reset();
+            }
+        }
+        return *this;
+    }
+
+    Variant(const Variant&) = delete;
+    Variant& operator=(const Variant&) = delete;
+
+    ~Variant()
+    {
+        reset();
+    }
+
+    bool empty() const
+    {
+        return index_ < 0;
+    }
+
+    // Call visitor(T&) with the value. Must not be empty.
+    template<typename Visitor>
+    void visit(Visitor& visitor)
+    {
+        typedef void (*VisitFn)(void*, Visitor&);
+        static const VisitFn visit_fns[] = { &visitValue<Ts, Visitor>... };
+        visit_fns[index_](&storage_, visitor);
+    }
+
+    void reset()
+    {
+        if (index_ >= 0)
+        {
+            static const DestroyFn destroy_fns[] = { &destroyValue<Ts>... };
+            destroy_fns[index_](&storage_);
+            index_ = -1;
+        }
+    }
+
+private:
+    typedef void (*MoveFn)(void*, void*);
+    typedef void (*DestroyFn)(void*);
+
+    template<typename T>
+    static void moveValue(void* from, void* to)
+    {
+        new (to) T(std::move(*static_cast<T*>(from)));
+    }
+
+    template<typename T>
+    static void destroyValue(void* value)
+    {
+        static_cast<T*>(value)->~T();
+    }
+
+    template<typename T, typename Visitor>
+    static void visitValue(void* value, Visitor& visitor)
+    {
+        visitor(*static_cast<T*>(value));
+    }
+
+    typename std::aligned_storage<detail::MaxSize<Ts...>::size, detail::MaxSize<Ts...>::align>::type storage_;
+    int index_;
+};
+
+}
+
+#endif
@@ -0,0 +1,211 @@
+#include "WavFile.hpp"
+
+#include "Logger.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+namespace spotify_backstage {
+
+namespace {
+
+const int HEADER_SIZE = 44;
+
+void putLe(std::vector<char>& buf, uint32_t val, int num_bytes)
+{
+    for (int i = 0; i < num_bytes; ++i)
+        buf.push_back(static_cast<char>((val >> (8 * i)) & 0xff));
+}
+
+void putTag(std::vector<char>& buf, const char* tag)
+{
+    buf.insert(buf.end(), tag, tag + 4);
+}
+
+uint32_t getLe(const std::vector<char>& buf, std::size_t pos, int num_bytes)
+{
+    uint32_t val = 0;
+    for (int i = 0; i < num_bytes; ++i)
+        val |= static_cast<uint32_t>(static_cast<unsigned char>(buf[pos + i])) << (8 * i);
+
+    return val;
+}
+
+bool hasTag(const std::vector<char>& buf, std::size_t pos, const char* tag)
+{
+    return pos + 4 <= buf.size() && std::memcmp(&buf[pos], tag, 4) == 0;
+}
+
+}
+
+bool readWav(const std::string& path, WavData& wav)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    const std::vector<char> buf((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (!hasTag(buf, 0, "RIFF") || !hasTag(buf, 8, "WAVE"))
+    {
+        LOG("Not a WAV file: " << path);
+        return false;
+    }
+
+    int format = 0;
+    int bits = 0;
+    std::size_t data_pos = 0;
+    std::size_t data_size = 0;
+
+    for (std::size_t pos = 12; pos + 8 <= buf.size(); )
+    {
+        const std::size_t chunk_size = getLe(buf, pos + 4, 4);
+        const auto body = pos + 8;
+
+        if (hasTag(buf, pos, "fmt ") && body + 16 <= buf.size())
+        {
+            format = getLe(buf, body, 2);
+            wav.num_channels = getLe(buf, body + 2, 2);
+            wav.sample_rate = getLe(buf, body + 4, 4);
+            bits = getLe(buf, body + 14, 2);
+
+            // WAVE_FORMAT_EXTENSIBLE has the actual format in the beginning of the sub-format GUID
+            if (format == 0xfffe && body + 26 <= buf.size())
+                format = getLe(buf, body + 24, 2);
+        }
+        else if (hasTag(buf, pos, "data"))
+        {
+            data_pos = body;
+            data_size = std::min(chunk_size, buf.size() - body);
+        }
+
+        // Chunks are padded to even size
+        pos = body + chunk_size + (chunk_size & 1);
+    }
+
+    const auto bytes = bits / 8;
+    const auto is_pcm = format == 1 && (bits == 16 || bits == 24 || bits == 32);
+    const auto is_float = format == 3 && bits == 32;
+
+    if (data_pos == 0 || wav.num_channels < 1 || wav.sample_rate < 1 || (!is_pcm && !is_float))
+    {
+        LOG("Unsupported WAV file: " << path << ", format " << format << ", " << bits << " bits");
+        return false;
+    }
+
+    wav.samples.resize(data_size / bytes);
+    for (std::size_t i = 0; i < wav.samples.size(); ++i)
+    {
+        const auto raw = getLe(buf, data_pos + i * bytes, bytes);
+        if (is_float)
+        {
+            float val;
+            std::memcpy(&val, &raw, sizeof(val));
+            wav.samples[i] = val;
+        }
+        else
+        {
+            // Sign extend and scale to [-1.0, 1.0]
+            const auto shifted = static_cast<int32_t>(raw << (32 - bits));
+            wav.samples[i] = shifted / 2147483648.0f;
+        }
+    }
+
+    wav.samples.resize(wav.samples.size() / wav.num_channels * wav.num_channels);
+    return true;
+}
+
+WavWriter::WavWriter()
+  : file_(), sample_rate_(0), num_channels_(0), data_bytes_(0), buffer_()
+{
+}
+
+WavWriter::~WavWriter()
+{
+    close();
+}
+
+bool WavWriter::isOpen() const
+{
+    return file_.is_open();
+}
+
+int WavWriter::getSampleRate() const
+{
+    return sample_rate_;
+}
+
+int WavWriter::getNumChannels() const
+{
+    return num_channels_;
+}
+
+bool WavWriter::open(const std::string& path, int sample_rate, int num_channels)
+{
+    close();
+
+    file_.open(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!file_)
+    {
+        LOG("Couldn't open " << path << " for writing");
+        return false;
+    }
+
+    sample_rate_ = sample_rate;
+    num_channels_ = num_channels;
+    data_bytes_ = 0;
+    writeHeader();
+
+    return static_cast<bool>(file_);
+}
+
+bool WavWriter::write(const int16_t* data, int num_samples)
+{
+    buffer_.resize(2 * num_samples);
+    for (int i = 0; i < num_samples; ++i)
+    {
+        const auto sample = static_cast<uint16_t>(data[i]);
+        buffer_[2 * i] = static_cast<char>(sample & 0xff);
+        buffer_[2 * i + 1] = static_cast<char>(sample >> 8);
+    }
+
+    file_.write(buffer_.data(), buffer_.size());
+    data_bytes_ += buffer_.size();
+
+    return static_cast<bool>(file_);
+}
+
+bool WavWriter::close()
+{
+    if (!file_.is_open())
+        return true;
+
+    // Now that the amount of data is known, fill in the sizes
+    file_.seekp(0);
+    writeHeader();
+    file_.close();
+
+    return !file_.fail();
+}
+
+void WavWriter::writeHeader()
+{
+    const auto block_align = 2 * num_channels_;
+
+    std::vector<char> header;
+    header.reserve(HEADER_SIZE);
+    putTag(header, "RIFF");
+    putLe(header, HEADER_SIZE - 8 + data_bytes_, 4);
+    putTag(header, "WAVE");
+    putTag(header, "fmt ");
+    putLe(header, 16, 4); // fmt chunk size
+    putLe(header, 1, 2); // PCM
+    putLe(header, num_channels_, 2);
+    putLe(header, sample_rate_, 4);
+    putLe(header, sample_rate_ * block_align, 4);
+    putLe(header, block_align, 2);
+    putLe(header, 16, 2); // bits per sample
+    putTag(header, "data");
+    putLe(header, data_bytes_, 4);
+
+    file_.write(header.data(), header.size());
+}
+
+}
@@ -0,0 +1,52 @@
+#ifndef SPOTIFY_BACKSTAGE_WAVFILE_HPP
+#define SPOTIFY_BACKSTAGE_WAVFILE_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace spotify_backstage {
+
+// Contents of a WAV file. The samples are interleaved and scaled to [-1.0, 1.0].
+struct WavData
+{
+    WavData() : sample_rate(0), num_channels(0), samples() {}
+
+    int sample_rate;
+    int num_channels;
+    std::vector<float> samples;
+};
+
+// Read a 16, 24 or 32-bit PCM or 32-bit float WAV file
+bool readWav(const std::string& path, WavData& wav);
+
+// Writes 16-bit PCM WAV files. The sizes in the header are filled in when the file is closed.
+class WavWriter
+{
+public:
+    WavWriter();
+    ~WavWriter();
+
+    bool isOpen() const;
+    int getSampleRate() const;
+    int getNumChannels() const;
+
+    bool open(const std::string& path, int sample_rate, int num_channels);
+    bool write(const int16_t* data, int num_samples);
+    bool close();
+
+private:
+    void writeHeader();
+
+    std::ofstream file_;
+    int sample_rate_;
+    int num_channels_;
+    uint32_t data_bytes_;
+    // Samples converted to little endian before writing
+    std::vector<char> buffer_;
+};
+
+}
+
+#endif
@@ -0,0 +1,147 @@
+#include "WorkerPool.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace spotify_backstage {
+
+class WorkerPool::Impl
+{
+public:
+    Impl(int num_threads, const std::function<void()>& thread_init)
+      : thread_init_(thread_init),
+        mutex_(),
+        start_cv_(),
+        done_cv_(),
+        job_(nullptr),
+        num_tasks_(0),
+        next_task_(0),
+        tasks_done_(0),
+        generation_(0),
+        terminate_(false),
+        threads_()
+    {
+        for (int i = 1; i < num_threads; ++i)
+            threads_.push_back(std::thread(&Impl::workerLoop, this));
+    }
+
+    Impl(const Impl&) = delete;
+    Impl& operator=(const Impl&) = delete;
+
+    ~Impl()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            terminate_ = true;
+        }
+
+        start_cv_.notify_all();
+        for (auto& thread : threads_)
+            thread.join();
+    }
+
+    int getNumThreads() const
+    {
+        return threads_.size() + 1;
+    }
+
+    void run(const std::function<void(int)>& job, int num_tasks)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = &job;
+            num_tasks_ = num_tasks;
+            next_task_ = 0;
+            tasks_done_ = 0;
+            ++generation_;
+        }
+
+        start_cv_.notify_all();
+        doTasks();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this] { return tasks_done_ == num_tasks_; });
+        job_ = nullptr;
+    }
+
+private:
+    void workerLoop()
+    {
+        if (thread_init_)
+            thread_init_();
+
+        uint64_t generation = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                start_cv_.wait(lock, [this, generation] { return terminate_ || generation_ != generation; });
+                if (terminate_)
+                    return;
+
+                generation = generation_;
+            }
+
+            doTasks();
+        }
+    }
+
+    void doTasks()
+    {
+        while (true)
+        {
+            const std::function<void(int)>* job = nullptr;
+            int task = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (next_task_ >= num_tasks_)
+                    return;
+
+                job = job_;
+                task = next_task_++;
+            }
+
+            (*job)(task);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (++tasks_done_ == num_tasks_)
+                done_cv_.notify_one();
+        }
+    }
+
+    const std::function<void()> thread_init_;
+    std::mutex mutex_;
+    std::condition_variable start_cv_;
+    std::condition_variable done_cv_;
+    const std::function<void(int)>* job_;
+    int num_tasks_;
+    int next_task_;
+    int tasks_done_;
+    uint64_t generation_;
+    bool terminate_;
+    std::vector<std::thread> threads_;
+};
+
+WorkerPool::WorkerPool(int num_threads, const std::function<void()>& thread_init)
+  : impl_(new Impl(num_threads, thread_init))
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+}
+
+int WorkerPool::getNumThreads() const
+{
+    return impl_->getNumThreads();
+}
+
+void WorkerPool::run(const std::function<void(int)>& job, int num_tasks)
+{
+    impl_->run(job, num_tasks);
+}
+
+}
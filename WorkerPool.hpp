@@ -0,0 +1,30 @@
+#ifndef SPOTIFY_BACKSTAGE_WORKERPOOL_HPP
+#define SPOTIFY_BACKSTAGE_WORKERPOOL_HPP
+
+#include <functional>
+#include <memory>
+
+namespace spotify_backstage {
+
+// Fixed set of threads for running the tasks of one job in parallel.
+// The thread calling run() works on the tasks too, and run() returns when all the tasks are done.
+class WorkerPool
+{
+public:
+    // thread_init is called at the start of each thread of the pool, if set
+    explicit WorkerPool(int num_threads, const std::function<void()>& thread_init = nullptr);
+    ~WorkerPool();
+
+    int getNumThreads() const;
+
+    // Call job(i) for each i in [0, num_tasks)
+    void run(const std::function<void(int)>& job, int num_tasks);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+}
+
+#endif
@@ -0,0 +1,293 @@
+// Compares Channel<Variant<...>> with a PolyM-style queue: heap-allocated messages in a std::queue,
+// dynamic_cast on receive. The PolyM-style queue is a reimplementation of how PolyM passes messages, not PolyM
+// itself, as PolyM isn't a dependency any more. Run without arguments. Prints the time and the heap allocations
+// per message.
+
+#include "../Channel.hpp"
+#include "../Variant.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <thread>
+
+namespace {
+
+std::atomic<long long> num_allocations(0);
+
+}
+
+void* operator new(std::size_t size)
+{
+    ++num_allocations;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+
+using namespace spotify_backstage;
+
+const int NUM_MESSAGES = 1000000;
+const int NUM_REQUESTS = 100000;
+const int CAPACITY = 64;
+
+// Messages as in SoundSystem
+
+struct Write
+{
+    const int16_t* data;
+    int num_samples;
+};
+
+struct Flush
+{
+};
+
+struct Terminate
+{
+};
+
+// PolyM-style queue, reimplemented here
+
+struct PolyMsg
+{
+    explicit PolyMsg(int id_p) : id(id_p) {}
+    virtual ~PolyMsg() {}
+    int id;
+};
+
+template<typename T>
+struct PolyDataMsg : PolyMsg
+{
+    PolyDataMsg(int id_p, const T& payload_p) : PolyMsg(id_p), payload(payload_p) {}
+    T payload;
+};
+
+class PolyQueue
+{
+public:
+    PolyQueue() : mutex_(), not_empty_(), queue_() {}
+
+    void put(std::unique_ptr<PolyMsg>&& msg)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push(std::move(msg));
+        }
+        not_empty_.notify_one();
+    }
+
+    std::unique_ptr<PolyMsg> get()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return !queue_.empty(); });
+        auto msg = std::move(queue_.front());
+        queue_.pop();
+        return msg;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::queue<std::unique_ptr<PolyMsg>> queue_;
+};
+
+enum PolyMsgId
+{
+    WRITE,
+    FLUSH,
+    TERMINATE
+};
+
+class Result
+{
+public:
+    Result(const char* name, int num_messages)
+      : name_(name), num_messages_(num_messages), start_(std::chrono::steady_clock::now()),
+        start_allocations_(num_allocations)
+    {
+    }
+
+    void print() const
+    {
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_).count();
+        std::printf("%-28s %8.1f ns/msg %6.2f allocations/msg\n", name_, static_cast<double>(ns) / num_messages_,
+            static_cast<double>(num_allocations - start_allocations_) / num_messages_);
+    }
+
+private:
+    const char* name_;
+    int num_messages_;
+    std::chrono::steady_clock::time_point start_;
+    long long start_allocations_;
+};
+
+void benchPolyM()
+{
+    PolyQueue queue;
+    long long sum = 0;
+
+    Result result("PolyM-style put/get", NUM_MESSAGES);
+    std::thread consumer([&queue, &sum]
+    {
+        while (true)
+        {
+            const auto msg = queue.get();
+            if (msg->id == TERMINATE)
+                break;
+            if (msg->id == WRITE)
+                sum += dynamic_cast<PolyDataMsg<Write>&>(*msg).payload.num_samples;
+        }
+    });
+
+    for (int i = 0; i < NUM_MESSAGES; ++i)
+        queue.put(std::unique_ptr<PolyMsg>(new PolyDataMsg<Write>(WRITE, Write{nullptr, i % 2})));
+    queue.put(std::unique_ptr<PolyMsg>(new PolyMsg(TERMINATE)));
+    consumer.join();
+    result.print();
+
+    if (sum < 0)
+        std::printf("%lld\n", sum);
+}
+
+typedef Variant<Write, Flush, Terminate> Msg;
+
+struct Dispatch
+{
+    void operator()(Write& msg) { sum += msg.num_samples; }
+    void operator()(Flush&) {}
+    void operator()(Terminate&) { keep_running = false; }
+
+    long long sum;
+    bool keep_running;
+};
+
+// The producer sends as fast as it can. When it outruns the consumer, the ring fills up and the rest spill
+// over to the deque.
+void benchChannel()
+{
+    Channel<Msg> channel(CAPACITY);
+    Dispatch dispatch{0, true};
+
+    Result result("Channel put/get, burst", NUM_MESSAGES);
+    std::thread consumer([&channel, &dispatch]
+    {
+        Msg msg;
+        while (dispatch.keep_running)
+        {
+            channel.get(msg);
+            msg.visit(dispatch);
+        }
+    });
+
+    for (int i = 0; i < NUM_MESSAGES; ++i)
+        channel.put(Write{nullptr, i % 2});
+    channel.put(Terminate());
+    consumer.join();
+    result.print();
+
+    std::printf("%-28s %8lld overflowed to the deque\n", "", channel.getNumOverflows());
+}
+
+// The producer keeps at most half a ring of messages in flight, like the writes to SoundSystem, which wait
+// for the previous ones to be handled.
+void benchChannelPaced()
+{
+    Channel<Msg> channel(CAPACITY);
+    Dispatch dispatch{0, true};
+    std::atomic<int> num_received(0);
+
+    Result result("Channel put/get, paced", NUM_MESSAGES);
+    std::thread consumer([&channel, &dispatch, &num_received]
+    {
+        Msg msg;
+        while (dispatch.keep_running)
+        {
+            channel.get(msg);
+            msg.visit(dispatch);
+            ++num_received;
+        }
+    });
+
+    for (int i = 0; i < NUM_MESSAGES; ++i)
+    {
+        while (i - num_received >= CAPACITY / 2)
+            std::this_thread::yield();
+        channel.put(Write{nullptr, i % 2});
+    }
+    channel.put(Terminate());
+    consumer.join();
+    result.print();
+
+    std::printf("%-28s %8lld overflowed to the deque\n", "", channel.getNumOverflows());
+}
+
+struct Request
+{
+    Reply<int>* reply;
+};
+
+void benchRequestReply()
+{
+    Channel<Variant<Request, Terminate>> channel(CAPACITY);
+
+    struct Server
+    {
+        void operator()(Request& msg) { msg.reply->set(1); }
+        void operator()(Terminate&) { keep_running = false; }
+        bool keep_running;
+    };
+
+    std::thread server([&channel]
+    {
+        Server dispatch{true};
+        Variant<Request, Terminate> msg;
+        while (dispatch.keep_running)
+        {
+            channel.get(msg);
+            msg.visit(dispatch);
+        }
+    });
+
+    Result result("Channel request/reply", NUM_REQUESTS);
+    int sum = 0;
+    for (int i = 0; i < NUM_REQUESTS; ++i)
+    {
+        Reply<int> reply;
+        channel.put(Request{&reply});
+        sum += reply.wait();
+    }
+    result.print();
+
+    channel.put(Terminate());
+    server.join();
+
+    if (sum != NUM_REQUESTS)
+        std::printf("Lost replies\n");
+}
+
+}
+
+int main()
+{
+    std::printf("PolyM-style = PolyM's way of passing messages, reimplemented in this benchmark. Not PolyM itself.\n");
+    benchPolyM();
+    benchChannel();
+    benchChannelPaced();
+    benchRequestReply();
+    return 0;
+}
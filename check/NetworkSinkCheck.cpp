@@ -0,0 +1,198 @@
+// Checks NetworkSink over loopback: a client connects and gets the HTTP header and the written samples,
+// and a client that doesn't read is dropped without holding up the others. Run without arguments.
+// Prints the result of each check, and exits with 0 if all passed.
+
+#include "../NetworkSink.hpp"
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+using namespace spotify_backstage;
+
+const int SAMPLE_RATE = 44100;
+const int NUM_CHANNELS = 2;
+const int WRITE_SIZE = 4096;
+// Far more than the sink buffers for a client that is behind
+const int NUM_WRITES = 2000;
+const int TIMEOUT_MS = 5000;
+
+int num_failed = 0;
+
+void check(bool ok, const char* what)
+{
+    std::printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+    if (!ok)
+        ++num_failed;
+}
+
+// Connect to the sink and send the request. A small receive buffer makes a client that doesn't read
+// fall behind quickly.
+int connectClient(int port, int receive_buffer = 0)
+{
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    if (receive_buffer > 0)
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(receive_buffer));
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+
+    const char request[] = "GET / HTTP/1.0\r\n\r\n";
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        write(fd, request, sizeof(request) - 1) != static_cast<ssize_t>(sizeof(request) - 1))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Wait until the sink has num_clients streaming clients
+bool waitForClients(const NetworkSink& sink, int num_clients)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(TIMEOUT_MS);
+    while (sink.getNumClients() != num_clients)
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// Read from fd until num_bytes have come after the header, the connection closes or nothing comes in time
+std::string readStream(int fd, std::size_t num_bytes)
+{
+    std::string data;
+    char buf[65536];
+
+    while (true)
+    {
+        const auto end = data.find("\r\n\r\n");
+        if (end != std::string::npos && data.size() - end - 4 >= num_bytes)
+            return data;
+
+        pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, TIMEOUT_MS) <= 0)
+            return data;
+
+        const auto n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+            return data;
+        data.append(buf, n);
+    }
+}
+
+int16_t sampleAt(int i)
+{
+    return static_cast<int16_t>(i * 7);
+}
+
+void writeSamples(NetworkSink& sink, int first)
+{
+    std::vector<int16_t> samples(WRITE_SIZE);
+    for (int i = 0; i < WRITE_SIZE; ++i)
+        samples[i] = sampleAt(first + i);
+    sink.write(SAMPLE_RATE, NUM_CHANNELS, samples.data(), samples.size());
+}
+
+// The header announces the format, and the samples come in network byte order
+void checkStream()
+{
+    NetworkSink sink(0);
+    check(sink.isOpen(), "sink listens on a free port");
+
+    const int fd = connectClient(sink.getPort());
+    check(fd >= 0 && waitForClients(sink, 1), "client connects");
+
+    const int num_writes = 10;
+    for (int i = 0; i < num_writes; ++i)
+        writeSamples(sink, i * WRITE_SIZE);
+
+    const std::size_t num_bytes = 2 * num_writes * WRITE_SIZE;
+    const auto data = readStream(fd, num_bytes);
+    const auto end = data.find("\r\n\r\n");
+    check(end != std::string::npos, "client gets the HTTP header");
+    if (end == std::string::npos)
+    {
+        close(fd);
+        return;
+    }
+
+    const auto header = data.substr(0, end);
+    check(header.find("200 OK") != std::string::npos &&
+        header.find("Content-Type: audio/L16;rate=44100;channels=2") != std::string::npos,
+        "header announces audio/L16 with the written format");
+
+    bool samples_ok = data.size() - end - 4 >= num_bytes;
+    const auto* bytes = reinterpret_cast<const unsigned char*>(data.data() + end + 4);
+    for (int i = 0; samples_ok && i < num_writes * WRITE_SIZE; ++i)
+        samples_ok = static_cast<int16_t>((bytes[2 * i] << 8) | bytes[2 * i + 1]) == sampleAt(i);
+    check(samples_ok, "client gets the written samples in network byte order");
+
+    close(fd);
+    writeSamples(sink, 0);
+    check(waitForClients(sink, 0), "closed client is removed");
+}
+
+// A client that doesn't read falls behind the buffered chunks and is dropped. A reading client keeps getting
+// everything meanwhile.
+void checkSlowClient()
+{
+    NetworkSink sink(0);
+
+    const int fast = connectClient(sink.getPort());
+    const int slow = connectClient(sink.getPort(), 4096);
+    check(fast >= 0 && slow >= 0 && waitForClients(sink, 2), "two clients connect");
+
+    const std::size_t num_bytes = 2 * static_cast<std::size_t>(NUM_WRITES) * WRITE_SIZE;
+    std::atomic<std::size_t> num_read(0);
+    std::thread reader([fast, num_bytes, &num_read]
+    {
+        const auto data = readStream(fast, num_bytes);
+        const auto end = data.find("\r\n\r\n");
+        num_read = end == std::string::npos ? 0 : data.size() - end - 4;
+    });
+
+    // Paced, so that only the client that doesn't read falls behind
+    for (int i = 0; i < NUM_WRITES; ++i)
+    {
+        writeSamples(sink, i * WRITE_SIZE);
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+
+    check(waitForClients(sink, 1), "client that doesn't read is dropped");
+
+    reader.join();
+    check(num_read >= num_bytes, "reading client gets all the samples");
+
+    close(fast);
+    close(slow);
+}
+
+}
+
+int main()
+{
+    checkStream();
+    checkSlowClient();
+    return num_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+// Checks the offline render without libspotify: a stand-in delivers audio to RenderWriter the way
+// the session's music delivery callback does, in blocks of varying size, and the WAV file is read back.
+// Run without arguments. Prints the result of each check, and exits with 0 if all passed.
+
+#include "../RenderWriter.hpp"
+#include "../WavFile.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+using namespace spotify_backstage;
+
+const int SAMPLE_RATE = 44100;
+const int NUM_CHANNELS = 2;
+// Two seconds, delivered in blocks like libspotify's
+const int NUM_FRAMES = 2 * SAMPLE_RATE;
+const int BLOCK_SIZES[] = { 2048, 1, 8192, 441, 4096 };
+const char* const PATH = "render-check.wav";
+
+int num_failed = 0;
+
+void check(bool ok, const char* what)
+{
+    std::printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+    if (!ok)
+        ++num_failed;
+}
+
+// Bass and treble tones, so that the equalizer has something to change
+std::vector<int16_t> makeTrack()
+{
+    std::vector<int16_t> samples(NUM_FRAMES * NUM_CHANNELS);
+    for (int i = 0; i < NUM_FRAMES; ++i)
+    {
+        const double t = static_cast<double>(i) / SAMPLE_RATE;
+        const double x = 8000 * std::sin(2 * M_PI * 60 * t) + 4000 * std::sin(2 * M_PI * 8000 * t);
+        for (int ch = 0; ch < NUM_CHANNELS; ++ch)
+            samples[i * NUM_CHANNELS + ch] = static_cast<int16_t>(x);
+    }
+    return samples;
+}
+
+// Deliver the track like the music delivery callback does. Returns false if a write failed.
+bool deliver(RenderWriter& writer, const std::vector<int16_t>& track)
+{
+    int frame = 0;
+    for (int i = 0; frame < NUM_FRAMES; ++i)
+    {
+        const int num_frames = std::min(BLOCK_SIZES[i % 5], NUM_FRAMES - frame);
+        if (!writer.write(SAMPLE_RATE, NUM_CHANNELS, &track[frame * NUM_CHANNELS], num_frames))
+            return false;
+        frame += num_frames;
+    }
+    return true;
+}
+
+bool render(const EqState& eq_state, const std::vector<int16_t>& track, WavData& wav)
+{
+    RenderWriter writer(PATH, eq_state);
+    const bool delivered = deliver(writer, track);
+    return writer.close() && delivered && readWav(PATH, wav);
+}
+
+bool sameAs(const WavData& wav, const std::vector<int16_t>& track)
+{
+    if (wav.samples.size() != track.size())
+        return false;
+
+    for (std::size_t i = 0; i < track.size(); ++i)
+        if (static_cast<int>(std::lround(wav.samples[i] * 32768)) != track[i])
+            return false;
+
+    return true;
+}
+
+double energy(const WavData& wav)
+{
+    double sum = 0;
+    for (auto sample : wav.samples)
+        sum += sample * sample;
+    return sum;
+}
+
+}
+
+int main()
+{
+    const auto track = makeTrack();
+
+    WavData plain;
+    check(render(EqState(false, 1.0, 1.0, 1.0, 1.0), track, plain), "render with the equalizer off");
+    check(plain.sample_rate == SAMPLE_RATE && plain.num_channels == NUM_CHANNELS, "file has the delivered format");
+    check(sameAs(plain, track), "file has the delivered samples unchanged");
+
+    WavData no_bass;
+    check(render(EqState(true, 1.0, 0.0, 1.0, 1.0), track, no_bass), "render with the bass cut");
+    check(no_bass.samples.size() == track.size() && energy(no_bass) < 0.5 * energy(plain), "bass cut is applied");
+
+    WavData graphic;
+    std::vector<double> bands(10, 1.0);
+    bands[1] = 0.0;
+    check(render(EqState(true, 1.0, 1.0, 1.0, 1.0, false, bands), track, graphic), "render with the graphic equalizer");
+    check(graphic.samples.size() == track.size() && energy(graphic) < 0.9 * energy(plain),
+        "63 Hz band cut is applied");
+
+    {
+        RenderWriter writer(PATH, EqState(false, 1.0, 1.0, 1.0, 1.0));
+        const bool first = writer.write(SAMPLE_RATE, NUM_CHANNELS, track.data(), 1024);
+        const bool changed = writer.write(48000, NUM_CHANNELS, track.data(), 1024);
+        writer.close();
+        check(first && !changed, "format change during the render fails it");
+    }
+
+    {
+        RenderWriter writer("no-such-directory/render-check.wav", EqState(false, 1.0, 1.0, 1.0, 1.0));
+        check(!writer.write(SAMPLE_RATE, NUM_CHANNELS, track.data(), 1024) && !writer.isOpen(),
+            "unwritable path fails the render");
+    }
+
+    std::remove(PATH);
+    return num_failed == 0 ? 0 : 1;
+}